@@ -56,7 +56,8 @@
  *   'S' | 'F'    SNES
  *   'F' | 'C'    NES
  *
- * Writing at byte 6 might one day control the rumble motor. Rumbles on when non-zero.
+ * Writing at byte 6 controls the rumble motor (N64 rumble pak or Gamecube
+ * controller). Rumbles on when non-zero.
  */
 void pack_classic_data_mode1(classic_pad_data *src, unsigned char dst[PACKED_CLASSIC_DATA_SIZE], int analog_style)
 {
@@ -0,0 +1,263 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <avr/io.h>
+#include "timebase.h"
+#include "phase.h"
+#include "wiimote.h"
+#include "gcn64_protocol.h"
+#include "cpak.h"
+
+#ifdef WITH_CPAK
+
+/* Longest block transfer: A write sends 35 bytes (1.1ms), a read
+ * receives 33 (1.1ms, or 1.6ms from a HORI pad). */
+#define SLOT_TICKS			TIMEBASE_US_TO_TICKS(1800)
+
+/* Attempts per block, one per frame */
+#define MAX_ATTEMPTS		4
+
+#define TICKS_PER_SECOND	(F_CPU / TIMEBASE_PRESCALER)
+
+static unsigned char cur_cmd;
+static unsigned int cur_addr;
+static unsigned char attempts;
+
+/* Command, address (with its checksum) and data for a write */
+static unsigned char block_buf[3 + CPAK_BLOCK_SIZE];
+
+static unsigned int blocks;
+static unsigned int window_bytes;
+static unsigned char retries;
+
+static unsigned int window_mark;
+static unsigned long window_ticks;
+
+static void put16(unsigned char *dst, unsigned int v)
+{
+	dst[0] = v >> 8;
+	dst[1] = v;
+}
+
+/* 5 bit checksum in the low bits of the address */
+static unsigned char cpak_addrCrc(unsigned int addr)
+{
+	// For address bits 5 to 15
+	static const unsigned char xor_table[11] = {
+		0x15, 0x1f, 0x0b, 0x16, 0x19, 0x07, 0x0e, 0x1c, 0x0d, 0x1a, 0x01
+	};
+	unsigned char crc = 0;
+	unsigned char i;
+
+	for (i=0; i<11; i++) {
+		if (addr & (0x20 << i))
+			crc ^= xor_table[i];
+	}
+
+	return crc;
+}
+
+/* CRC-8, polynomial 0x85, over the 32 data bytes. The controller
+ * sends it after reads and writes. */
+static unsigned char cpak_dataCrc(const volatile unsigned char *data)
+{
+	unsigned char crc = 0;
+	unsigned char i, bit, x;
+
+	for (i=0; i<=CPAK_BLOCK_SIZE; i++) {
+		for (bit=0x80; bit; bit >>= 1) {
+			x = (crc & 0x80) ? 0x85 : 0x00;
+			crc <<= 1;
+			if (i < CPAK_BLOCK_SIZE && (data[i] & bit))
+				crc |= 1;
+			crc ^= x;
+		}
+	}
+
+	return crc;
+}
+
+void cpak_init(void)
+{
+	window_mark = timebase_now();
+}
+
+static void cpak_setStatus(unsigned char status)
+{
+	wm_setRegs(CPAK_REG_STATUS, &status, 1);
+}
+
+/* Reads the command from the registers, if any */
+static void cpak_accept(void)
+{
+	unsigned char cmd, none = CPAK_CMD_NONE;
+
+	cmd = wm_getReg(CPAK_REG_CMD);
+	if (cmd == CPAK_CMD_NONE)
+		return;
+	wm_setRegs(CPAK_REG_CMD, &none, 1);
+
+	cur_addr = (wm_getReg(CPAK_REG_ADDR) << 8) | wm_getReg(CPAK_REG_ADDR + 1);
+	cur_addr &= ~(CPAK_BLOCK_SIZE - 1);
+	attempts = 0;
+
+	if (cmd != CPAK_CMD_READ && cmd != CPAK_CMD_WRITE) {
+		cpak_setStatus(CPAK_ERR_COMMAND);
+		return;
+	}
+	if (cur_addr >= CPAK_SIZE) {
+		cpak_setStatus(CPAK_ERR_ADDRESS);
+		return;
+	}
+
+	if (cmd == CPAK_CMD_WRITE) {
+		unsigned char i;
+
+		for (i=0; i<CPAK_BLOCK_SIZE; i++) {
+			block_buf[3 + i] = wm_getReg(CPAK_REG_DATA + i);
+		}
+	}
+
+	cur_cmd = cmd;
+	cpak_setStatus(CPAK_STATUS_BUSY);
+}
+
+/* One attempt. Returns 0 when done, or a CPAK_ERR_* code. */
+static unsigned char cpak_transfer(void)
+{
+	unsigned char crc;
+	unsigned int start, bus_time;
+	unsigned char reg[2];
+	int count, expected;
+
+	block_buf[0] = cur_cmd == CPAK_CMD_READ ? N64_EXPANSION_READ : N64_EXPANSION_WRITE;
+	block_buf[1] = cur_addr >> 8;
+	block_buf[2] = cur_addr | cpak_addrCrc(cur_addr);
+	expected = cur_cmd == CPAK_CMD_READ ? (CPAK_BLOCK_SIZE + 1) * 8 : 8;
+
+	start = timebase_now();
+	count = gcn64_transactionExpect(block_buf, cur_cmd == CPAK_CMD_READ ? 3 : 3 + CPAK_BLOCK_SIZE, expected);
+	bus_time = timebase_now() - start;
+
+	put16(reg, bus_time);
+	wm_setRegs(CPAK_REG_BUS_TIME, reg, 2);
+
+	if (count != expected) {
+		return CPAK_ERR_NO_CONTROLLER;
+	}
+
+	if (cur_cmd == CPAK_CMD_READ) {
+		crc = cpak_dataCrc(gcn64_workbuf);
+		if (gcn64_workbuf[CPAK_BLOCK_SIZE] != crc) {
+			// Without a pak, the controller sends the checksum inverted
+			return gcn64_workbuf[CPAK_BLOCK_SIZE] == (crc ^ 0xff) ? CPAK_ERR_NO_PAK : CPAK_ERR_CHECKSUM;
+		}
+		wm_setRegs(CPAK_REG_DATA, (unsigned char*)gcn64_workbuf, CPAK_BLOCK_SIZE);
+	} else {
+		crc = cpak_dataCrc(block_buf + 3);
+		if (gcn64_workbuf[0] != crc) {
+			return gcn64_workbuf[0] == (crc ^ 0xff) ? CPAK_ERR_NO_PAK : CPAK_ERR_CHECKSUM;
+		}
+	}
+
+	return 0;
+}
+
+static void cpak_blockDone(void)
+{
+	unsigned char reg[2];
+
+	blocks++;
+	window_bytes += CPAK_BLOCK_SIZE;
+	put16(reg, blocks);
+	wm_setRegs(CPAK_REG_BLOCKS, reg, 2);
+
+	cur_addr += CPAK_BLOCK_SIZE;
+	put16(reg, cur_addr);
+	wm_setRegs(CPAK_REG_ADDR, reg, 2);
+
+	cur_cmd = CPAK_CMD_NONE;
+	cpak_setStatus(CPAK_STATUS_DONE);
+}
+
+/* Throughput over the last second. Frames are assumed to be less than
+ * one timebase wrap apart, as in profile.c */
+static void cpak_updateRate(void)
+{
+	unsigned int now;
+	unsigned char reg[2];
+
+	now = timebase_now();
+	window_ticks += (unsigned int)(now - window_mark);
+	window_mark = now;
+
+	if (window_ticks >= TICKS_PER_SECOND) {
+		put16(reg, window_bytes);
+		wm_setRegs(CPAK_REG_RATE, reg, 2);
+		window_bytes = 0;
+		window_ticks = 0;
+	}
+}
+
+void cpak_frame(char n64_active, unsigned int until)
+{
+	unsigned int start;
+	unsigned char error;
+
+	cpak_updateRate();
+
+	if (cur_cmd == CPAK_CMD_NONE) {
+		cpak_accept();
+		if (cur_cmd == CPAK_CMD_NONE)
+			return;
+	}
+
+	if (!n64_active) {
+		cur_cmd = CPAK_CMD_NONE;
+		cpak_setStatus(CPAK_ERR_NO_CONTROLLER);
+		return;
+	}
+
+	// The slot is right before the controller read, well after the
+	// I2C burst. Without a known poll period, there is no such slot.
+	start = until - SLOT_TICKS;
+	if (!phase_isLocked() || (int)(start - timebase_now()) < 0) {
+		return;
+	}
+	timebase_sleepUntil(start);
+
+	error = cpak_transfer();
+	if (!error) {
+		cpak_blockDone();
+		return;
+	}
+
+	attempts++;
+	if (error == CPAK_ERR_NO_PAK || attempts >= MAX_ATTEMPTS) {
+		cur_cmd = CPAK_CMD_NONE;
+		cpak_setStatus(error);
+		return;
+	}
+
+	// Try again next frame
+	if (retries != 0xff) {
+		retries++;
+		wm_setRegs(CPAK_REG_RETRIES, &retries, 1);
+	}
+}
+
+#endif // WITH_CPAK
@@ -0,0 +1,80 @@
+#ifndef _cpak_h__
+#define _cpak_h__
+
+/* N64 Controller Pak (memory pak) access from the I2C side. Only built
+ * with -DWITH_CPAK.
+ *
+ * The pak is read and written in 32 byte blocks through a window in the
+ * virtual register space (address 0x52):
+ *
+ *  0xB0       Command, written by the master: 1 = read block, 2 = write
+ *             block. Reset to 0 once accepted.
+ *  0xB1       Status: 0 = idle, 1 = busy, 2 = done, 0x80 and up = error
+ *             (see CPAK_ERR_*).
+ *  0xB2-0xB3  Block address (0x0000-0x7FE0). Advances by 32 after each
+ *             block, so consecutive blocks only need the command.
+ *  0xB4-0xB5  Blocks transferred, since power up
+ *  0xB6-0xB7  Bytes per second, over the last second
+ *  0xB8-0xB9  Bus time of the last block, in timebase ticks
+ *  0xBA       Retried block transfers (bad checksum or no reply)
+ *  0xC0-0xDF  Block data. Filled by a read, to be filled before a write.
+ *
+ * 16 bit values are big endian. The master waits for status "done"
+ * before reading the data or writing the next command.
+ *
+ * One block is transferred per frame, in the idle time before the
+ * controller read (so gameplay input is never delayed). With the wiimote
+ * polling every 5ms, a full 32KB backup or restore is 1024 frames, 5.1
+ * seconds, if the master sends the next command within one frame.
+ *
+ * Bus time per block, from the bit timings (computed, not measured):
+ * A read is 3 bytes out and 33 back, about 1.16ms (1.7ms for HORI
+ * timings). A write is 35 bytes out and 1 back, about 1.16ms. Both are
+ * longer than GCN64_MAX_HOLD_US, so interrupts stay on: The TWI is never
+ * stretched by a block. A TWI interrupt during one corrupts it instead,
+ * and it is retried (0xBA counts those).
+ */
+
+#define CPAK_REG_CMD		0xB0
+#define CPAK_REG_STATUS		0xB1
+#define CPAK_REG_ADDR		0xB2
+#define CPAK_REG_BLOCKS		0xB4
+#define CPAK_REG_RATE		0xB6
+#define CPAK_REG_BUS_TIME	0xB8
+#define CPAK_REG_RETRIES	0xBA
+#define CPAK_REG_DATA		0xC0
+
+#define CPAK_CMD_NONE		0
+#define CPAK_CMD_READ		1
+#define CPAK_CMD_WRITE		2
+
+#define CPAK_STATUS_IDLE	0
+#define CPAK_STATUS_BUSY	1
+#define CPAK_STATUS_DONE	2
+#define CPAK_ERR_NO_CONTROLLER	0x80	// No N64 controller, or no reply (all attempts)
+#define CPAK_ERR_NO_PAK			0x81	// Inverted checksum: Nothing in the expansion port
+#define CPAK_ERR_CHECKSUM		0x82	// Bad checksum, all attempts
+#define CPAK_ERR_ADDRESS		0x83	// Address out of the pak
+#define CPAK_ERR_COMMAND		0x84	// Unknown command
+
+#define CPAK_BLOCK_SIZE		32
+#define CPAK_SIZE			0x8000
+
+#ifdef WITH_CPAK
+
+void cpak_init(void);
+
+/* Called once per frame, before waiting for the time to read the
+ * controller ('until', see phase_getUpdateTime()). When a command is
+ * pending, an N64 controller is connected (n64_active) and the block
+ * fits before 'until', it is transferred right before it. */
+void cpak_frame(char n64_active, unsigned int until);
+
+#else
+
+#define cpak_init()				do { } while(0)
+#define cpak_frame(n64, until)	do { } while(0)
+
+#endif
+
+#endif // _cpak_h__
@@ -40,15 +40,17 @@ static unsigned char cur_id = CTL_ID_GENESIS3;
 
 #ifdef DB9_V2
 
-static inline unsigned char SAMPLE()
+/* Bit 'from' of v moved to bit 'to'. With constants, this folds to a
+ * shift and a mask (no branch). */
+#define MOVE_BIT(v, from, to)	((from) >= (to) ? \
+			(((v) >> ((from) - (to))) & (1 << (to))) : \
+			(((v) << ((to) - (from))) & (1 << (to))))
+
+/* c and b are PINC and PINB, as sampled by the read engine */
+static inline unsigned char SAMPLE(unsigned char c, unsigned char b)
 {
-	unsigned char c;
-	unsigned char b;
 	unsigned char res;
 
-	c = PINC;
-	b = PINB;
-
 	/* Target bits in 'res' are:
 	 *
 	 * 0: Up/Up/Z				DB9 pin 1
@@ -61,14 +63,12 @@ static inline unsigned char SAMPLE()
 	 * 7:
 	 */
 
-	res = 0;
-
-	if (b & 0x04) res |= 0x01; // Up
-	if (b & 0x10) res |= 0x02; // Down
-	if (c & 0x02) res |= 0x04; // Left
-	if (c & 0x08) res |= 0x08; // Right
-	if (b & 0x08) res |= 0x10; // B/A
-	if (c & 0x04) res |= 0x20; // C/Start
+	res =	MOVE_BIT(b, 2, 0) |	// Up		PB2
+			MOVE_BIT(b, 4, 1) |	// Down		PB4
+			MOVE_BIT(c, 1, 2) |	// Left		PC1
+			MOVE_BIT(c, 3, 3) |	// Right	PC3
+			MOVE_BIT(b, 3, 4) |	// B/A		PB3
+			MOVE_BIT(c, 2, 5);	// C/Start	PC2
 
 	return res;
 }
@@ -79,15 +79,11 @@ static inline unsigned char SAMPLE()
 
 #else
 
-static inline unsigned char SAMPLE()
+/* c and b are PINC and PINB, as sampled by the read engine */
+static inline unsigned char SAMPLE(unsigned char c, unsigned char b)
 {
-	unsigned char c;
-	unsigned char b;
 	unsigned char res;
 
-	c = PINC;
-	b = PINB;
-
 	/* Target bits in 'res' are:
 	 *
 	 * 0: Up/Up/Z
@@ -127,77 +123,113 @@ static char db9Update(void);
 
 static db9_pad_data last_read_state, last_reported_state;
 
+/* Time between steps (SELECT edges and samples). Genesis controllers
+ * settle within a few microseconds, 20 was used for a long time.
+ *
+ * When the 8 steps take no more than DB9_MAX_HOLD_US, they are run with
+ * interrupts held (a TWI byte arriving meanwhile is stretched). Longer
+ * reads leave interrupts on, as they always did: A TWI interrupt only
+ * delays a step, far from the 1.5ms after which 6 button pads restart
+ * their count. */
+#ifndef DB9_SELECT_DELAY_US
+#define DB9_SELECT_DELAY_US	4
+#endif
+#define DB9_MAX_HOLD_US		64
+
+#define STEP_SAMPLE			0x01
+#define STEP_SELECT_LOW		0x02
+#define STEP_SELECT_HIGH	0x04
+#define STEP_END			0x80
+
+/* |   1 |  2  |  3  |  4  | 5 ...
+ * ___    __    __    __    __
+ *    |__|  |__|  |__|  |__|
+ *  ^  ^     ^     ^   ^
+ *  A  B     D     E   C
+ *
+ *  ABC are used when reading controllers.
+ *  D and E are used for auto-detecting the genesis 6 btn controller.
+ *
+ * SELECT is high before the first step. Samples are taken before moving
+ * SELECT, in the order A, B, D, E, C.
+ */
+static const unsigned char genesis_steps[] = {
+	STEP_SAMPLE | STEP_SELECT_LOW,	// A
+	STEP_SAMPLE | STEP_SELECT_HIGH,	// B
+	STEP_SELECT_LOW,
+	STEP_SAMPLE | STEP_SELECT_HIGH,	// D
+	STEP_SELECT_LOW,
+	STEP_SAMPLE | STEP_SELECT_HIGH,	// E
+	STEP_SAMPLE | STEP_SELECT_LOW,	// C
+	STEP_SELECT_HIGH | STEP_END,
+};
+
 #define READ_CONTROLLER_SIZE 5
-static void readController(unsigned char bits[READ_CONTROLLER_SIZE])
+
+// PINC and PINB for each sample
+static unsigned char step_pins[READ_CONTROLLER_SIZE * 2];
+
+/* Returns where the next sample goes */
+static inline unsigned char *doStep(unsigned char step, unsigned char *sample)
 {
-	unsigned char a,b,c,d,e;
+	if (step & STEP_SAMPLE) {
+		sample[0] = PINC;
+		sample[1] = PINB;
+		sample += 2;
+	}
 
-	// total delays: 160 microseconds.
+	if (step & STEP_SELECT_LOW) {
+		CLR_SELECT();
+	}
+	if (step & STEP_SELECT_HIGH) {
+		SET_SELECT();
+	}
 
-	/* |   1 |  2  |  3  |  4  | 5 ...
-	 * ___    __    __    __    __
-	 *    |__|  |__|  |__|  |__|
-	 *  ^  ^     ^     ^   ^
-	 *  A  B     D     E   C
-	 *
-	 *  ABC are used when reading controllers.
-	 *  D and E are used for auto-detecting the genesis 6 btn controller.
-	 *
-	 */
+	return sample;
+}
 
-//	DDRC |= 0x08;
-//	PORTC |= 0x08;
+static void runSteps(const unsigned char *steps)
+{
+	unsigned char sreg;
+	unsigned char *sample = step_pins;
+	unsigned char step;
 
-	/* 1 */
-	SET_SELECT();
-	_delay_us(20);
-	a = SAMPLE();
+	sreg = SREG;
+#if DB9_SELECT_DELAY_US * 8 <= DB9_MAX_HOLD_US
+	cli();
+#endif
 
-//	PORTC &= ~0x08;
+	do {
+		_delay_us(DB9_SELECT_DELAY_US);
+		step = *steps;
+		steps++;
+		sample = doStep(step, sample);
+	} while (!(step & STEP_END));
 
+	SREG = sreg;
+}
+
+static void readController(unsigned char bits[READ_CONTROLLER_SIZE])
+{
+	static const unsigned char order[READ_CONTROLLER_SIZE] = { 0, 1, 3, 4, 2 }; // A B D E C
+	unsigned char i;
+
+	// No SELECT pulses for these (SELECT stays high): One sample, now
 	if (cur_id == CTL_ID_ATARI ||
 		cur_id == CTL_ID_SMS) {
-		bits[0] = a;
+		bits[0] = SAMPLE(PINC, PINB);
 		bits[1] = 0xff;
 		bits[2] = 0xff;
 
 		return;
 	}
 
-	CLR_SELECT();
-	_delay_us(20);		
-	b = SAMPLE();
-
-	/* 2 */
-	SET_SELECT();
-	_delay_us(20);		
-	CLR_SELECT();
-	_delay_us(20);		
-	d = SAMPLE();
-
-	/* 3 */
 	SET_SELECT();
-	_delay_us(20);		
-	CLR_SELECT();
-	_delay_us(20);			
-	e = SAMPLE();
+	runSteps(genesis_steps);
 
-	/* 4 */
-	SET_SELECT();
-	_delay_us(20);			
-	c = SAMPLE();
-
-	CLR_SELECT();
-	_delay_us(20);			
-
-	/* 5 */
-	SET_SELECT();
-
-	bits[0] = a;
-	bits[1] = b;
-	bits[2] = c;
-	bits[3] = d;
-	bits[4] = e;
+	for (i=0; i<READ_CONTROLLER_SIZE; i++) {
+		bits[order[i]] = SAMPLE(step_pins[i*2], step_pins[i*2+1]);
+	}
 }
 
 static char db9Init(void)
@@ -253,10 +285,8 @@ static char db9Init(void)
 	return 0;
 }
 
-static char db9Update(void)
+static void db9Decode(unsigned char data[READ_CONTROLLER_SIZE], db9_pad_data *dst)
 {
-	unsigned char data[READ_CONTROLLER_SIZE];
-
 	/* 0: Up//Z
 	 * 1: Down//Y
 	 * 2: Left//X
@@ -264,7 +294,6 @@ static char db9Update(void)
 	 * 4: Btn B/A
 	 * 5: Btn C/Start/
 	 */
-	readController(data);
 
 	/* Buttons are active low. Invert the bits
 	 * here to simplify subsequent 'if' statements... */
@@ -272,36 +301,71 @@ static char db9Update(void)
 	data[1] = data[1] ^ 0xff;
 	data[2] = data[2] ^ 0xff;
 
-	memset(&last_read_state, 0, sizeof(db9_pad_data));
+	memset(dst, 0, sizeof(db9_pad_data));
 
-	if (data[0] & 1) { last_read_state.buttons |= DB9_BTN_DPAD_UP; }
-	if (data[0] & 2) { last_read_state.buttons |= DB9_BTN_DPAD_DOWN; }
-	if (data[0] & 4) { last_read_state.buttons |= DB9_BTN_DPAD_LEFT; }
-	if (data[0] & 8) { last_read_state.buttons |= DB9_BTN_DPAD_RIGHT; }
+	if (data[0] & 1) { dst->buttons |= DB9_BTN_DPAD_UP; }
+	if (data[0] & 2) { dst->buttons |= DB9_BTN_DPAD_DOWN; }
+	if (data[0] & 4) { dst->buttons |= DB9_BTN_DPAD_LEFT; }
+	if (data[0] & 8) { dst->buttons |= DB9_BTN_DPAD_RIGHT; }
 
 	if (isGenesis(cur_id)) {
-		last_read_state.pad_type = PAD_TYPE_MD;
+		dst->pad_type = PAD_TYPE_MD;
 
-		if (data[1]&0x10) { last_read_state.buttons |= DB9_BTN_A; } // A
-		if (data[0]&0x10) { last_read_state.buttons |= DB9_BTN_B; } // B
-		if (data[0]&0x20) { last_read_state.buttons |= DB9_BTN_C; } // C
-		if (data[1]&0x20) { last_read_state.buttons |= DB9_BTN_START; } // Start
+		if (data[1]&0x10) { dst->buttons |= DB9_BTN_A; } // A
+		if (data[0]&0x10) { dst->buttons |= DB9_BTN_B; } // B
+		if (data[0]&0x20) { dst->buttons |= DB9_BTN_C; } // C
+		if (data[1]&0x20) { dst->buttons |= DB9_BTN_START; } // Start
 		if (cur_id == CTL_ID_GENESIS6) {
-			if (data[2]&0x04) { last_read_state.buttons |= DB9_BTN_X; } // X
-			if (data[2]&0x02) { last_read_state.buttons |= DB9_BTN_Y; } // Y
-			if (data[2]&0x01) { last_read_state.buttons |= DB9_BTN_Z; } // Z
-			if (data[2]&0x08) { last_read_state.buttons |= DB9_BTN_MODE; } // Mode
+			if (data[2]&0x04) { dst->buttons |= DB9_BTN_X; } // X
+			if (data[2]&0x02) { dst->buttons |= DB9_BTN_Y; } // Y
+			if (data[2]&0x01) { dst->buttons |= DB9_BTN_Z; } // Z
+			if (data[2]&0x08) { dst->buttons |= DB9_BTN_MODE; } // Mode
 		}
 	}
 	else {
-		last_read_state.pad_type = PAD_TYPE_SMS;
+		dst->pad_type = PAD_TYPE_SMS;
 
 		/* The button IDs for 1 and 2 button joysticks should start
 		 * at '1'. Some Atari emulators don't support button remapping so
 		 * this is pretty important! */
-		if (data[0]&0x10) { last_read_state.buttons |= DB9_BTN_B; } // Button 1
-		if (data[0]&0x20) { last_read_state.buttons |= DB9_BTN_C; } // Button 2
+		if (data[0]&0x10) { dst->buttons |= DB9_BTN_B; } // Button 1
+		if (data[0]&0x20) { dst->buttons |= DB9_BTN_C; } // Button 2
 	}
+}
+
+#ifdef WITH_OVERSAMPLE
+// Buttons seen pressed by the samples since the last update
+static unsigned short latched_buttons;
+
+/* Not for 6 button controllers: Their extra buttons come from counting
+ * SELECT pulses, and the count only restarts after 1.5ms without any. A
+ * sample too close to the update would shift what the update reads. */
+static void db9Sample(void)
+{
+	unsigned char data[READ_CONTROLLER_SIZE];
+	db9_pad_data sample;
+
+	if (cur_id == CTL_ID_GENESIS6)
+		return;
+
+	readController(data);
+	db9Decode(data, &sample);
+	latched_buttons |= sample.buttons;
+}
+#endif
+
+static char db9Update(void)
+{
+	unsigned char data[READ_CONTROLLER_SIZE];
+
+	readController(data);
+	db9Decode(data, &last_read_state);
+
+#ifdef WITH_OVERSAMPLE
+	// Presses from the samples are reported once. Releases are as of now.
+	last_read_state.buttons |= latched_buttons;
+	latched_buttons = 0;
+#endif
 
 	return 0;
 }
@@ -324,6 +388,9 @@ static Gamepad db9Gamepad = {
 	.update		=	db9Update,
 	.changed	=	db9Changed,
 	.getReport	=	db9Report,
+#ifdef WITH_OVERSAMPLE
+	.sample		=	db9Sample,
+#endif
 };
 
 Gamepad *db9GetGamepad(void)
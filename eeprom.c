@@ -16,6 +16,7 @@
  */
 
 #include <avr/eeprom.h>
+#include <avr/interrupt.h>
 #include <string.h>
 #include "eeprom.h"
 #include "rlut.h"
@@ -61,12 +62,40 @@ struct eeprom_data_struct g_current_config = {
 	.merge_zl_zr = 0,
 };
 
+static char sync_deferred, sync_pending;
+
 void sync_config()
 {
+	if (sync_deferred) {
+		sync_pending = 1;
+		return;
+	}
 	memcpy(&g_eeprom_data, &g_current_config, sizeof(struct eeprom_data_struct));
 	eeprom_commit();
 }
 
+void config_deferSync(char defer)
+{
+	sync_deferred = defer;
+}
+
+void config_syncPending(void)
+{
+	unsigned char sreg;
+
+	sreg = SREG;
+	cli();
+	if (!sync_pending) {
+		SREG = sreg;
+		return;
+	}
+	sync_pending = 0;
+	memcpy(&g_eeprom_data, &g_current_config, sizeof(struct eeprom_data_struct));
+	SREG = sreg;
+
+	eeprom_commit();
+}
+
 void init_config()
 {
 	if (eeprom_init()) {
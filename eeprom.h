@@ -36,6 +36,12 @@ extern struct eeprom_data_struct g_current_config;
 void sync_config(void);
 void init_config(void);
 
+/* Writing the EEPROM takes milliseconds. While deferred (mapping done in
+ * an interrupt, see WITH_FRESH_REPORT in main.c), sync_config() only
+ * takes note, and the main loop writes later with config_syncPending(). */
+void config_deferSync(char defer);
+void config_syncPending(void);
+
 #define MODE_N64_STANDARD		0
 #define MODE_MARIOKART64		1
 #define MODE_OCARINA			2
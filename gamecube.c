@@ -27,6 +27,7 @@
 #include "gamecube.h"
 #include "gcn64_protocol.h"
 #include "eeprom.h"
+#include "profile.h"
 
 /*********** prototypes *************/
 static char gamecubeInit(void);
@@ -39,8 +40,48 @@ static gamepad_data last_built_report;
 /* What was most recently sent to the host */
 static gamepad_data last_sent_report;
 
-static char origins_set = 0;
-static unsigned char orig_x, orig_y, orig_cx, orig_cy;
+/* The motor state rides on the status command */
+static unsigned char gc_rumbling;
+
+/* Origins (rest positions) of the sticks and triggers, read from the
+ * controller with GC_GET_ORIGINS. Subtracted from each status read. */
+static unsigned char orig_x = 0x80, orig_y = 0x80, orig_cx = 0x80, orig_cy = 0x80;
+static unsigned char orig_lt, orig_rt;
+
+/* Set at detection and when the controller raises the origin flag: The
+ * next update reads the origins instead of the status. Both replies start
+ * with the same 8 bytes and take about as long (the origins command is
+ * shorter, the reply longer), so this costs no extra bus time. */
+static char origins_pending = 1;
+static unsigned char last_origin_flag;
+
+#define GC_ORIGIN_FLAG	0x20 // In byte 0
+
+/* Init state. Steady state is GC_STATE_READY, where only the status is
+ * read. The others send one command per update and report a neutral
+ * controller, so a Wavebird turned off is not taken for a disconnected
+ * controller: It is back as soon as it is turned on again. */
+#define GC_STATE_GETID	0	// Read the ID
+#define GC_STATE_FIX	1	// Wavebird: Fix the receiver to the controller ID
+#define GC_STATE_READY	2
+static unsigned char gc_state = GC_STATE_GETID;
+static unsigned char gc_fix_id[2];
+
+/* Neutral updates in a row (controller off or pairing) before reporting
+ * a disconnect instead, about 10 seconds at 5ms polls. It lasts until a
+ * detection finds the controller on again. */
+#define GC_NEUTRAL_MAX_UPDATES	2000
+static unsigned int gc_neutral_updates;
+
+#define GC_PROBE_UPDATES	4
+
+/* Build with -DGC_CHECK_FIXED_BITS=1 to drop status replies where the
+ * always 0 and always 1 bits are wrong. Bit 2 is not checked: It is not
+ * constant (origins flag). Off by default, as it always was, since
+ * other "constant" bits may have a meaning on some controllers. */
+#ifndef GC_CHECK_FIXED_BITS
+#define GC_CHECK_FIXED_BITS	0
+#endif
 
 static char gamecubeInit(void)
 {
@@ -48,29 +89,29 @@ static char gamecubeInit(void)
 	return 0;
 }
 
-void gc_decodeAnswer()
+/* Checking adds protection against corruption (if the "constant" bits
+ * are invalid, maybe others are : Drop the packet). I have seen bit 2 in
+ * a high state (this is the origin flag), so only bits 0, 1 and 8 are
+ * looked at. */
+static char gc_checkAnswer(void)
 {
-	char tmp;
-	int i;
-	unsigned char x,y,cx,cy;
-
-	// Note: Checking seems a good idea, adds protection
-	// against corruption (if the "constant" bits are invalid, 
-	// maybe others are : Drop the packet). 
-	//
-	// However, I have seen bit 2 in a high state. To be as compatible
-	// as possible, I decided NOT to look at these bits since instead
-	// of being "constant" bits they might have a meaning I don't know.
-
+#if GC_CHECK_FIXED_BITS
 	// Check the always 0 and always 1 bits
-#if 0
-	if (gcn64_workbuf[0] || gcn64_workbuf[1] || gcn64_workbuf[2])
-		return 1;
+	if (gcn64_workbuf[0] & 0xc0)
+		return 0;
 
-	if (!gcn64_workbuf[8])
-		return 1;
+	if (!(gcn64_workbuf[1] & 0x80))
+		return 0;
 #endif
-	
+
+	return 1;
+}
+
+void gc_decodeAnswer()
+{
+	unsigned char *raw = last_built_report.gc.raw_data;
+	unsigned char lt, rt;
+
 /*
 	(Source: Nintendo Gamecube Controller Protocol
 		updated 8th March 2004, by James.)
@@ -96,54 +137,21 @@ void gc_decodeAnswer()
  */
 
 	last_built_report.pad_type = PAD_TYPE_GAMECUBE;
-	last_built_report.gc.buttons = 0;
-
-	for (i=0; i<16; i++) {
-		if (gcn64_workbuf[i]) {
-			last_built_report.gc.buttons |= 1<<i;
-		}
-	}
-
-	for (x=0,i=0; i<8; i++) // X axis
-		x |= gcn64_workbuf[i+16] ? (0x80>>i) : 0;
-	
-	for (y=0,i=0; i<8; i++) // Y axis
-		y |= gcn64_workbuf[i+24] ? (0x80>>i) : 0;
-	
-	for (cx=0,i=0; i<8; i++) // C X axis
-		cx |= gcn64_workbuf[i+32] ? (0x80>>i) : 0;
-	last_built_report.gc.cx = cx;
-
-	for (cy=0,i=0; i<8; i++) // C Y axis
-		cy |= gcn64_workbuf[i+40] ? (0x80>>i) : 0;	
-	last_built_report.gc.cy = cy;
-
-
-	if (origins_set) {
-		last_built_report.gc.x = ((int)x-(int)orig_x);
-		last_built_report.gc.y = ((int)y-(int)orig_y);
-		last_built_report.gc.cx = ((int)cx-(int)orig_cx);
-		last_built_report.gc.cy = ((int)cy-(int)orig_cy);
-	} else {
-		orig_x = x;
-		orig_y = y;	
-		orig_cx = cx;
-		orig_cy = cy;	
-		last_built_report.gc.x = 0;
-		last_built_report.gc.y = 0;
-		last_built_report.gc.cx = 0;
-		last_built_report.gc.cy = 0;
-		origins_set = 1;
-	}
-
-
-	for (tmp=0,i=0; i<8; i++) // Left btn value
-		tmp |= gcn64_workbuf[i+48] ? (0x80>>i) : 0;
-	last_built_report.gc.lt = tmp;
-	
-	for (tmp=0,i=0; i<8; i++) // Right btn value
-		tmp |= gcn64_workbuf[i+56] ? (0x80>>i) : 0;	
-	last_built_report.gc.rt = tmp;
+	last_built_report.gc.buttons = gcn64_decodeButtons(raw, GC_RAW_SIZE);
+
+	last_built_report.gc.x = raw[2] - orig_x;
+	last_built_report.gc.y = raw[3] - orig_y;
+	last_built_report.gc.cx = raw[4] - orig_cx;
+	last_built_report.gc.cy = raw[5] - orig_cy;
+
+	// Triggers at rest may be a bit below their origin. The clamp costs a
+	// compare and branch per trigger and read, about 8 cycles in all
+	// (counted, not measured). It cannot be done once at origin time,
+	// as it depends on the reading.
+	lt = raw[6];
+	rt = raw[7];
+	last_built_report.gc.lt = lt > orig_lt ? lt - orig_lt : 0;
+	last_built_report.gc.rt = rt > orig_rt ? rt - orig_rt : 0;
 
 	if (g_current_config.easy_triggers) {
 #define EARLY_LR_THRES 50
@@ -154,53 +162,155 @@ void gc_decodeAnswer()
 			last_built_report.gc.buttons |= GC_BTN_R;
 		}
 	}
+}
 
-	// Copy all the data as-is for the raw field
-	memset(last_built_report.gc.raw_data, 0, GC_RAW_SIZE);
-	for (i=0; i<64; i++) {
-		if (gcn64_workbuf[i]) {
-			last_built_report.gc.raw_data[i/8] |= 0x80 >> (i%8);
-		}
+
+/* Reply to GC_GET_ORIGINS in gcn64_workbuf. The first 8 bytes are laid
+ * out like a status reply. */
+static void gc_setOrigins(void)
+{
+	orig_x = gcn64_workbuf[2];
+	orig_y = gcn64_workbuf[3];
+	orig_cx = gcn64_workbuf[4];
+	orig_cy = gcn64_workbuf[5];
+	orig_lt = gcn64_workbuf[6];
+	orig_rt = gcn64_workbuf[7];
+	origins_pending = 0;
+}
+
+/* Update with the controller off (Wavebird): Nothing pressed, centered. */
+static void gc_neutralReport(void)
+{
+	memset(&last_built_report, 0, sizeof(last_built_report));
+	last_built_report.pad_type = PAD_TYPE_GAMECUBE;
+}
+
+/* Reply to GC_GETID in gcn64_workbuf. Decides what the next update
+ * sends. Returns non-zero if there is a controller to read. */
+static char gc_handleId(void)
+{
+	if (!(gcn64_workbuf[0] & GC_ID_WIRELESS)) {
+		gc_state = GC_STATE_READY;
+		gc_neutral_updates = 0;
+		return 1;
+	}
+
+	// Wavebird receiver with the controller off (0xA80000). It will have
+	// new origins once turned on.
+	if (!(gcn64_workbuf[0] & GC_ID_WIRELESS_RECEIVED)) {
+		gc_state = GC_STATE_GETID;
+		origins_pending = 1;
+		return 0;
+	}
+
+	// Controller on (0xE9A0xx): Fix the receiver to its ID, unless done
+	// already (0xEBB0xx).
+	if (!(gcn64_workbuf[1] & GC_ID_WIRELESS_FIX)) {
+		gc_fix_id[0] = (gcn64_workbuf[1] & GC_ID_WIRELESS_ID_MASK) | GC_ID_WIRELESS_FIX;
+		gc_fix_id[1] = gcn64_workbuf[2];
+		gc_state = GC_STATE_FIX;
+		origins_pending = 1;
+		return 0;
+	}
+
+	gc_state = GC_STATE_READY;
+	gc_neutral_updates = 0;
+	return 1;
+}
+
+void gamecubeUseDetectionReply(void)
+{
+	gc_state = GC_STATE_GETID;
+	origins_pending = 1;
+	if (gcn64_workbuf[0] & GC_ID_WIRELESS_RECEIVED) {
+		gc_neutral_updates = 0;
 	}
+	gc_handleId();
 }
 
+/* Wavebird pairing and wake-up happen here, one command per update (the
+ * receiver needs time between commands, and this keeps every update
+ * shorter than a status read). Once ready, only the status is read.
+ *
+ * Not tried with a Wavebird yet: The sequence follows the documented
+ * IDs. GC_NEUTRAL_MAX_UPDATES bounds the neutral reports if it stalls. */
+static char gc_initStep(void)
+{
+	unsigned char tmpdata[3];
+	unsigned char count;
+
+	switch (gc_state)
+	{
+		case GC_STATE_GETID:
+			tmpdata[0] = GC_GETID;
+			count = gcn64_transactionExpect(tmpdata, 1, GC_GETID_REPLY_LENGTH);
+			if (count != GC_GETID_REPLY_LENGTH) {
+				return 1;
+			}
+			gc_handleId();
+			break;
+
+		case GC_STATE_FIX:
+			tmpdata[0] = GC_FIX_DEVICE;
+			tmpdata[1] = gc_fix_id[0];
+			tmpdata[2] = gc_fix_id[1];
+			count = gcn64_transactionExpect(tmpdata, 3, GC_FIX_DEVICE_REPLY_LENGTH);
+			if (count != GC_FIX_DEVICE_REPLY_LENGTH) {
+				gc_state = GC_STATE_GETID;
+				return 1;
+			}
+			// Confirm with the ID on the next update
+			gc_state = GC_STATE_GETID;
+			break;
+	}
+
+	if (gc_neutral_updates >= GC_NEUTRAL_MAX_UPDATES) {
+		return 1;
+	}
+	gc_neutral_updates++;
+
+	gc_neutralReport();
+	return 0;
+}
 
 static char gamecubeUpdate()
 {
-	//unsigned char tmp=0;
 	unsigned char tmpdata[8];
 	unsigned char count;
 
-#if 0
-	/* The GetID command. This is required for the Nintendo Wavebird to work... */
-	tmp = GC_GETID;
-	count = gcn64_transaction(&tmp, 1);
-	if (count != GC_GETID_REPLY_LENGTH) {
-		return 1;
+	if (gc_state != GC_STATE_READY) {
+		return gc_initStep();
 	}
 
-	/* 
-	 * The wavebird needs time. It does not answer the 
-	 * folowwing get status command if we don't wait here.
-	 *
-	 * A good 2:1 safety margin has been chosen.
-	 *
-	 */
-	// 10 : does not work
-	// 20 : does not work
-	// 25 : works
-	// 30 : works
-	_delay_us(50);
-#endif
+	if (origins_pending) {
+		tmpdata[0] = GC_GET_ORIGINS;
 
-	tmpdata[0] = GC_GETSTATUS1;
-	tmpdata[1] = GC_GETSTATUS2;
-	tmpdata[2] = GC_GETSTATUS3(0);
-	
-	count = gcn64_transaction(tmpdata, 3);
-	if (count != GC_GETSTATUS_REPLY_LENGTH) {
-		return 1;
+		count = gcn64_transactionChecked(tmpdata, 1, GC_GET_ORIGINS_LENGTH, gc_checkAnswer);
+		if (count != GC_GET_ORIGINS_LENGTH) {
+			gc_state = GC_STATE_GETID;
+			return 1;
+		}
+		gc_setOrigins();
+	} else {
+		tmpdata[0] = GC_GETSTATUS1;
+		tmpdata[1] = GC_GETSTATUS2;
+		tmpdata[2] = GC_GETSTATUS3(gc_rumbling);
+
+		count = gcn64_transactionChecked(tmpdata, 3, GC_GETSTATUS_REPLY_LENGTH, gc_checkAnswer);
+		PROF_RUMBLE_SENT();
+		if (count != GC_GETSTATUS_REPLY_LENGTH) {
+			// Unplugged, or Wavebird turned off: Find out with the ID
+			gc_state = GC_STATE_GETID;
+			return 1;
+		}
+
+		// Re-read the origins when the flag goes up. Not while it stays
+		// up, or the sticks would always read as centered.
+		if ((gcn64_workbuf[0] & GC_ORIGIN_FLAG) && !last_origin_flag) {
+			origins_pending = 1;
+		}
 	}
+	last_origin_flag = gcn64_workbuf[0] & GC_ORIGIN_FLAG;
 
 	gc_decodeAnswer();
 
@@ -210,10 +320,19 @@ static char gamecubeUpdate()
 
 static char gamecubeProbe(void)
 {
-	origins_set = 0;
+	unsigned char i;
 
-	if (gamecubeUpdate()) {
-		return 0;
+	gc_state = GC_STATE_GETID;
+	origins_pending = 1;
+
+	// Through init and the origins (a Wavebird may stay off)
+	for (i=0; i<GC_PROBE_UPDATES; i++) {
+		if (gamecubeUpdate()) {
+			return 0;
+		}
+		if (gc_state == GC_STATE_READY && !origins_pending) {
+			break;
+		}
 	}
 
 	return 1;
@@ -230,12 +349,18 @@ static void gamecubeGetReport(gamepad_data *dst)
 		memcpy(dst, &last_built_report, sizeof(gamepad_data));
 }
 
+static void gamecubeSetVibration(int value)
+{
+	gc_rumbling = value != 0;
+}
+
 Gamepad GamecubeGamepad = {
 	.init					= gamecubeInit,
 	.update					= gamecubeUpdate,
 	.changed				= gamecubeChanged,
 	.getReport				= gamecubeGetReport,
 	.probe					= gamecubeProbe,
+	.setVibration			= gamecubeSetVibration,
 };
 
 Gamepad *gamecubeGetGamepad(void)
@@ -5,3 +5,8 @@
 
 Gamepad *gamecubeGetGamepad(void);
 
+/* Call right after gcn64_detectController() has found a Gamecube
+ * controller, with its ID reply still in gcn64_workbuf. Restarts init
+ * (Wavebird pairing) from that reply and schedules an origins read. */
+void gamecubeUseDetectionReply(void);
+
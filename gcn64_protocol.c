@@ -20,11 +20,42 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <util/delay.h>
 
 #include "gcn64_protocol.h"
+#include "timebase.h"
+#include "phase.h"
+#include "profile.h"
+
+volatile unsigned char gcn64_workbuf[GCN64_MAX_REPLY_BYTES];
+
+/* N64 controllers need a pause between transactions. Otherwise, after
+ * sending a rumble-on or rumble-off command (probably init too), the
+ * following get status fails. This starts to work at 2us. 5 should be
+ * safe. */
+#define GAP_TICKS	(TIMEBASE_US_TO_TICKS(5) + 1)
+
+static char gap_running;
+static unsigned int last_end;
+
+/* The bit timings leave no room for interrupts, so transfers are run
+ * with interrupts held. A TWI event arriving meanwhile stays pending and
+ * the TWI hardware holds SCL low (clock stretching) until it ends. That
+ * is kept to GCN64_MAX_HOLD_US: Enough for a status or origins read,
+ * even from the slowest pads. Longer transfers (expansion port) run with
+ * interrupts on, like every transfer used to. An interrupt then corrupts
+ * the transfer, which the checksums catch, and it is retried. Those are
+ * scheduled away from the I2C traffic anyway (see cpak.h, main.c).
+ *
+ * How long the wiimote tolerates stretching has not been measured. */
+#ifndef GCN64_MAX_HOLD_US
+#define GCN64_MAX_HOLD_US	560
+#endif
 
-volatile unsigned char gcn64_workbuf[260];
+/* Upper bound of a transfer: 4us per bit sent (and the stop bit), up to
+ * 6us per bit received (HORI pads), plus the reply delay. */
+#define GCN64_TRANSFER_US(out_bytes, in_bits)	((out_bytes) * 8 * 4 + 4 + (in_bits) * 6 + 8)
 
 /******** IO port definitions **************/
 #define GCN64_DATA_PORT	PORTC
@@ -32,51 +63,81 @@ volatile unsigned char gcn64_workbuf[260];
 #define GCN64_DATA_PIN	PINC
 #define GCN64_DATA_BIT	(1<<3)
 #define GCN64_BIT_NUM_S	"3" // for asm
-#undef FREQ_IS_16MHZ
-
-/*
- * \brief Explode bytes to bits
- * \param bytes 	The input byte array
- * \param num_bytes	The number of input bytes
- * \param workbuf_bit_offset	The offset to start writing at
- * \return number of bits (i.e. written output bytes)
- *
- * 1 input byte = 8 output bytes, where each output byte is zero or non-zero depending
- * on the input byte bits, starting with the most significant one.
- */
-static int bitsToWorkbufBytes(unsigned char *bytes, int num_bytes, int workbuf_bit_offset)
-{
-	int i, bit;
-	unsigned char p;
-
-	for (i=0,bit=0; i<num_bytes; i++) {
-		for (p=0x80; p; p>>=1) {
-			gcn64_workbuf[bit+workbuf_bit_offset] = bytes[i] & p;
-			bit++;
-		}
-	}	
 
-	return bit;
-}
+/* All timings below are derived from F_CPU. The send delays need at
+ * least 12 cycles per microsecond. */
+#if F_CPU != 12000000L && F_CPU != 16000000L && F_CPU != 20000000L
+#error gcn64_protocol.c supports F_CPU 12000000, 16000000 and 20000000 only
+#endif
+#define CYCLES_PER_US	(F_CPU / 1000000L)
 
 // The bit timeout is a counter to 127. This is the 
 // start value. Counting from 0 takes hundreads of 
 // microseconds. Because of this, the reception function
 // "hangs in there" much longer than necessary..
-#ifdef FREQ_IS_16MHZ
-#define TIMING_OFFSET	75
-#else
-#define TIMING_OFFSET	100 // gives about 12uS. Twice the expected maximum bit period.
-#endif
-
-static unsigned char gcn64_receive()
+//
+// Each count is one 5 cycle loop iteration.
+#define RX_COUNTS(us)	((us) * CYCLES_PER_US / 5)
+#define RX_TIMEOUT_US	12 // Twice the expected maximum bit period.
+#define TIMING_OFFSET	(128 - RX_COUNTS(RX_TIMEOUT_US))
+
+/* The high level after the stop bit ends the reply. Instead of always
+ * waiting RX_TIMEOUT_US, the timeout is set to twice the longest low
+ * level (the long half of a 0) seen in the last good reply: 6us for
+ * official controllers, 9us for HORI pads. Replies without a long low
+ * level are not used, and any failure goes back to RX_TIMEOUT_US. */
+#define RX_LONG_MIN		RX_COUNTS(2) // Short levels are 1.5us at most
+static unsigned char rx_high_offset = TIMING_OFFSET;
+static unsigned char rx_longest;
+
+/* \brief Receive a reply straight to packed bytes
+ *
+ * Each bit is a low level followed by a high level. Their lengths
+ * are counted and compared as soon as the next low level begins:
+ *
+ *          ________
+ * ________/
+ *
+ *   low     high
+ *
+ *          ________________
+ * 0 : ____/
+ *                      ____
+ * 1 : ________________/
+ *
+ * The timings on a real N64 are
+ *
+ * 0 : 1 us low, 3 us high
+ * 1 : 3 us low, 1 us high
+ *
+ * However, HORI pads use something similar to
+ *
+ * 0 : 1.5 us low, 4.5 us high
+ * 1 : 4.5 us low, 1.5 us high
+ *
+ * Since only which level is longer matters, both work.
+ *
+ * Bits are shifted in a register holding a marker bit. When the marker
+ * comes out, 8 bits have been received and the byte is stored in
+ * gcn64_workbuf, MSb first. The stop bit is a short low level followed
+ * by an "infinite" high level which times out and ends reception.
+ *
+ * When max_bytes have been stored, there is no need for the timeout:
+ * Reception ends as soon as the stop bit is over.
+ *
+ * \return The number of bits received, 0 on timeout/error (including
+ * the line staying low).
+ */
+static int gcn64_receive(unsigned char max_bytes)
 {
-	register unsigned char count=0;
+	unsigned char left = max_bytes, partial, longest;
+	unsigned char delta = rx_high_offset - TIMING_OFFSET;
+	int bits;
 
 #define SET_DBG	"	nop\n"
 #define CLR_DBG	"	nop\n"
-//#define SET_DBG	"	sbi %3, 4		\n"
-//#define CLR_DBG	"	cbi %3, 4		\n"
+//#define SET_DBG	"	sbi %6, 4		\n"
+//#define CLR_DBG	"	cbi %6, 4		\n"
 
 	// The data line has been released. 
 	// The receive part below expects it to be still high
@@ -85,58 +146,90 @@ static unsigned char gcn64_receive()
 	asm volatile(
 		"	push r30				\n"	// save Z
 		"	push r31				\n"	// save Z
-		
-		"	clr %0					\n"
+
+		"	ldi %1, 1				\n"	// Marker bit
+		"	ldi %2, %5				\n"	// Longest low level
 		"	clr r16					\n"
-"initial_wait_low:\n"
+"rx_initial_wait_low%=:\n"
 		"	inc r16					\n"
-		"	breq timeout			\n" // overflow to 0
-		"	sbic %2, "GCN64_BIT_NUM_S"		\n"
-		"	rjmp initial_wait_low	\n"
-
-		// the next transition is to a high bit	
-		"	rjmp waithigh			\n"
-
-"waitlow:\n"
-		"	ldi r16, %4				\n"
-"waitlow_lp:\n"
+		"	breq rx_fail%=			\n" // overflow to 0
+		"	sbic %4, "GCN64_BIT_NUM_S"		\n"
+		"	rjmp rx_initial_wait_low%=	\n"
+		"	rjmp rx_low%=			\n"
+
+"rx_high%=:\n"
+		"	mov r16, %7				\n"
+"rx_high_lp%=:\n"
 		"	inc r16					\n"
-		"	brmi timeout			\n" // > 127 (approx 50uS timeout)
-		"	sbic %2, "GCN64_BIT_NUM_S"			\n"
-		"	rjmp waitlow_lp			\n"
-	
-		"	inc %0					\n" // count this timed low level
-		"	breq overflow			\n" // > 255
-		"	st z+,r16				\n"
-
-"waithigh:\n"
-		"	ldi r16, %4				\n"
-"waithigh_lp:\n"
+		"	brmi rx_done%=			\n" // > 127. Stop bit, or no answer.
+		"	sbic %4, "GCN64_BIT_NUM_S"		\n"
+		"	rjmp rx_high_lp%=		\n"
+
+		// The next bit begins. The previous one is a 1 when
+		// its low level was shorter than its high level.
+		"	cp r17, r16				\n" // Carry set when r17 < r16
+		"	rol %1					\n"
+		"	brcc rx_low%=			\n" // Marker not out yet
+		"	st z+, %1				\n"
+		"	ldi %1, 1				\n"
+		"	dec %0					\n"
+		"	breq rx_stop%=			\n" // All expected bytes are in
+
+"rx_low%=:\n"
+		"	ldi r16, %5				\n"
+"rx_low_lp%=:\n"
 		"	inc r16					\n"
-		"	brmi timeout			\n" // > 127
-		"	sbis %2, "GCN64_BIT_NUM_S"		\n"
-		"	rjmp waithigh_lp		\n"
-	
-		"	inc %0					\n" // count this timed high level
-		"	breq overflow			\n" // > 255
-		"	st z+,r16				\n"
-
-		"	rjmp waitlow			\n"
-
-"overflow:  \n"
-"timeout:	\n"
-"			pop r31				\n" // restore z
-"			pop r30				\n" // restore z
-
-		: 	"=&r" (count)						// %0
-		: 	"z" ((unsigned char volatile *)gcn64_workbuf),		// %1
-			"I" (_SFR_IO_ADDR(GCN64_DATA_PIN)),	// %2
-			"I" (_SFR_IO_ADDR(PORTB)),			// %3
-			"M" (TIMING_OFFSET)					// %4
-		: 	"r16"
+		"	brmi rx_fail%=			\n" // > 127
+		"	sbis %4, "GCN64_BIT_NUM_S"		\n"
+		"	rjmp rx_low_lp%=		\n"
+		"	mov r17, r16			\n"
+		"	cp %2, r16				\n"
+		"	brsh 1f					\n"
+		"	mov %2, r16				\n"
+"1:\n"
+		"	add r17, %8				\n" // To the base of the high level count
+		"	rjmp rx_high%=			\n"
+
+"rx_stop%=:\n"
+		"	ldi r16, %5				\n" // Wait for the end of the stop bit
+"rx_stop_lp%=:\n"
+		"	inc r16					\n"
+		"	brmi rx_done%=			\n" // Stuck low. The data is complete anyway.
+		"	sbis %4, "GCN64_BIT_NUM_S"		\n"
+		"	rjmp rx_stop_lp%=		\n"
+		"	rjmp rx_done%=			\n"
+
+"rx_fail%=:\n"
+		"	clr %1					\n" // No answer, or stuck low
+"rx_done%=:\n"
+		"	pop r31					\n" // restore z
+		"	pop r30					\n" // restore z
+
+		: 	"+d" (left),						// %0
+			"=&d" (partial),					// %1
+			"=&d" (longest)						// %2
+		: 	"z" ((unsigned char volatile *)gcn64_workbuf),		// %3
+			"I" (_SFR_IO_ADDR(GCN64_DATA_PIN)),	// %4
+			"M" (TIMING_OFFSET),				// %5
+			"I" (_SFR_IO_ADDR(PORTB)),			// %6
+			"r" (rx_high_offset),				// %7
+			"r" (delta)							// %8
+		: 	"r16", "r17"
 	);
 
-	return count;
+	if (!partial)
+		return 0;
+
+	rx_longest = longest - TIMING_OFFSET;
+
+	// Full bytes, plus the bits in front of the marker
+	bits = (max_bytes - left) * 8;
+	while (partial > 1) {
+		partial >>= 1;
+		bits++;
+	}
+
+	return bits;
 }
 
 static void gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
@@ -146,31 +239,54 @@ static void gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
 	if (n_bytes == 0)
 		return;
 
-	// Explode the data to one byte per bit for very easy transmission in assembly.
-	// This trades memory for ease of implementation.
-	bits = bitsToWorkbufBytes(data, n_bytes, 0);
+	bits = n_bytes * 8;
 
 	// the value of the gpio is pre-configured to low. We simulate
 	// an open drain output by toggling the direction.
 #define PULL_DATA		"	sbi %0, "GCN64_BIT_NUM_S"\n"
 #define RELEASE_DATA	"	cbi %0, "GCN64_BIT_NUM_S"\n"
 
-#ifdef FREQ_IS_16MHZ
-	// busy looping delays based on busy loop and nop tuning.
-	// valid for 16Mhz clock. (Tuned to 1us/3us using a scope)
-#define DLY_SHORT_1ST	"ldi r17, 2\n nop\nrcall sb_dly%=\n "
-#define DLY_LARGE_1ST	"ldi r17, 13\n rcall sb_dly%=\n"
-#define DLY_SHORT_2ND	"nop\nnop\nnop\nnop\n" 
-#define DLY_LARGE_2ND	"ldi r17, 9\n rcall sb_dly%=\nnop\nnop\n"
-
-#else
-	// busy looping delays based on busy loop and nop tuning.
-	// valid for 12Mhz clock.
-#define DLY_SHORT_1ST	"ldi r17, 1\n rcall sb_dly%=\n "
-#define DLY_LARGE_1ST	"ldi r17, 9\n rcall sb_dly%=\n"
-#define DLY_SHORT_2ND	"\n" 
-#define DLY_LARGE_2ND	"ldi r17, 5\n rcall sb_dly%=\n nop\nnop\n"
-#endif
+	// Bits are shifted out of r16, MSb first. After the 8th bit, the
+	// next byte is loaded. This takes 6 cycles whether a byte is loaded
+	// or not, and happens during the long level of each bit (the low
+	// level of a 0, the high level of a 1) so all bits of a byte have
+	// the same timing.
+	// (After the last bit, the byte following the data is loaded, but
+	// not used)
+#define FETCH_NEXT		"	dec r18				\n" \
+						"	breq 1f				\n" \
+						"	nop\nnop			\n" \
+						"	rjmp 2f				\n" \
+						"1:	ld r16, z+			\n" \
+						"	ldi r18, 8			\n" \
+						"2:\n"
+
+	// Busy looping delays of n cycles (a constant operand). 10 cycles and
+	// more use the sb_dly loop (3 cycles per count, 7 for the call, load
+	// and return), shorter ones are only nops.
+#define DELAY(n)		"	.if " n " >= 10		\n" \
+						"	ldi r17, (" n " - 7) / 3	\n" \
+						"	rcall sb_dly%=		\n" \
+						"	.rept (" n " - 7) %% 3	\n" \
+						"	nop					\n" \
+						"	.endr				\n" \
+						"	.else				\n" \
+						"	.rept " n "			\n" \
+						"	nop					\n" \
+						"	.endr				\n" \
+						"	.endif				\n"
+
+	// The delays make each low and high level last 1us or 3us. The
+	// rest of the level is the fixed cost of the loop:
+	//
+	// 0 low:  FETCH_NEXT (6) + DLY_LARGE_1ST + cbi (2)
+	// 0 high: DLY_SHORT_2ND + sbiw, brne (4) + 6 to the next sbi + sbi (2)
+	// 1 low:  DLY_SHORT_1ST + cbi (2)
+	// 1 high: FETCH_NEXT (6) + DLY_LARGE_2ND + 4 + 6 + 2
+#define DLY_SHORT_1ST	DELAY("%[short1]")
+#define DLY_LARGE_1ST	DELAY("%[large1]")
+#define DLY_SHORT_2ND	DELAY("%[short2]")
+#define DLY_LARGE_2ND	DELAY("%[large2]")
 
 	asm volatile(
 	// Save the modified input operands
@@ -179,18 +295,18 @@ static void gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
 	"	push r30			\n" // z
 	"	push r31			\n"
 
-	"sb_loop%=:				\n"
 	"	ld r16, z+			\n"
-	"	tst r16				\n"
-	"	breq sb_send0%=		\n"
-	"	brne sb_send1%=		\n"
-
-	"	rjmp sb_end%=		\n" // not reached
+	"	ldi r18, 8			\n"
 
+	// 6 cycles from here to pulling the line, for 0s and 1s.
+	"sb_loop%=:				\n"
+	"	lsl r16				\n"
+	"	brcs sb_send1%=		\n"
+	"	nop\nnop\nnop\nnop	\n"
 
 	"sb_send0%=:			\n"
-	"	nop					\n"
 	PULL_DATA
+	FETCH_NEXT
 	DLY_LARGE_1ST
 	RELEASE_DATA
 	DLY_SHORT_2ND
@@ -199,9 +315,11 @@ static void gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
 	"	rjmp sb_end%=		\n"
 
 	"sb_send1%=:			\n"
+	"	nop\nnop\nnop		\n"
 	PULL_DATA
 	DLY_SHORT_1ST
 	RELEASE_DATA
+	FETCH_NEXT
 	DLY_LARGE_2ND
 	"	sbiw	%1, 1		\n"
 	"	brne sb_loop%=		\n"
@@ -215,19 +333,16 @@ static void gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
 	
 
 	"sb_end%=:\n"
-	// going here is fast so we need to extend the last
-	// delay by 500nS
+	// going here is fast (brne not taken, rjmp) so we need to extend
+	// the last delay by one cycle
 	"	nop\n "
-#ifdef FREQ_IS_16MHZ
-	"	nop\n"
-#endif
 	"	pop r31				\n"
 	"	pop r30				\n"
 	PULL_DATA
 	"	pop r29				\n"
 	"	pop r28				\n"
-	//DLY_SHORT_1ST
-	"nop\nnop\nnop\nnop\n"
+	// Stop bit: Same low level as a 1 (pops (4) + delay + cbi (2))
+	DELAY("%[stop]")
 	RELEASE_DATA
 
 	// Now, we need to loop until the wire is high to 
@@ -244,58 +359,14 @@ static void gcn64_sendBytes(unsigned char *data, unsigned char n_bytes)
 	:
 	: "I" (_SFR_IO_ADDR(GCN64_DATA_DDR)), // %0
 	  "w" (bits),						// %1
-	  "z" ((unsigned char volatile *)gcn64_workbuf),					// %2
-	  "I" (_SFR_IO_ADDR(GCN64_DATA_PIN))	// %3
-	: "r16", "r17");
-}
-
-/* \brief Decode the received length of low/high states to byte-per-bit format
- *
- * The result is in workbuf.
- *
- **/
-static void gcn64_decodeWorkbuf(unsigned char count)
-{
-	unsigned char i;
-	volatile unsigned char *output = gcn64_workbuf;
-	volatile unsigned char *input = gcn64_workbuf;
-	unsigned char t;
-
-    //  
-    //          ________
-    // ________/
-    //  
-    //   [i*2]    [i*2+1]
-    //  
-    //          ________________
-    // 0 : ____/
-    //                      ____
-    // 1 : ________________/
-    //  
-    // The timings on a real N64 are
-    //  
-    // 0 : 1 us low, 3 us high
-    // 1 : 3 us low, 1 us high
-    //  
-    // However, HORI pads use something similar to
-    //  
-    // 0 : 1.5 us low, 4.5 us high
-    // 1 : 4.5 us low, 1.5 us high
-    //  
-    //  
-    // No64 us = microseconds
-
-	// This operation takes approximately 100uS on 64bit gamecube messages
-	for (i=0; i<count; i++) {
-		t = *input; 
-		input++;
-
-		*output = t < *input;
-		input++;
-
-		output++;
-		
-	}
+	  "z" (data),						// %2
+	  "I" (_SFR_IO_ADDR(GCN64_DATA_PIN)),	// %3
+	  [short1] "M" (CYCLES_PER_US - 2),
+	  [large1] "M" (3 * CYCLES_PER_US - 8),
+	  [short2] "M" (CYCLES_PER_US - 12),
+	  [large2] "M" (3 * CYCLES_PER_US - 18),
+	  [stop] "M" (CYCLES_PER_US - 8)
+	: "r16", "r17", "r18");
 }
 
 void gcn64protocol_hwinit(void)
@@ -314,43 +385,118 @@ void gcn64protocol_hwinit(void)
 
 
 
+/* Called after a good reply: Adopt twice its longest low level as the
+ * end of reply timeout. */
+static void gcn64_calibrate(void)
+{
+	if (rx_longest < RX_LONG_MIN) {
+		return; // Only 1s. There was no long level to measure.
+	}
+
+	if (rx_longest * 2 >= RX_COUNTS(RX_TIMEOUT_US)) {
+		rx_high_offset = TIMING_OFFSET;
+	} else {
+		rx_high_offset = 128 - rx_longest * 2;
+	}
+}
+
 /**
  * \brief Send n data bytes + stop bit, wait for answer.
  * \return The number of bits received, 0 on timeout/error.
  *
- * The result is in gcn64_workbuf, where each byte represents
- * a bit.
+ * The result is in gcn64_workbuf, packed 8 bits per byte with
+ * the first bit received in the most significant bit. When the reply
+ * length is known (expected_bits), reception stops right after the stop
+ * bit instead of waiting for the end of reply timeout.
  */
-int gcn64_transaction(unsigned char *data_out, int data_out_len)
+int gcn64_transactionExpect(unsigned char *data_out, int data_out_len, int expected_bits)
 {
+	unsigned char sreg;
+	unsigned char max_bytes;
 	int count;
 
+	max_bytes = GCN64_MAX_REPLY_BYTES;
+	if (expected_bits > 0 && expected_bits <= GCN64_MAX_REPLY_BYTES * 8) {
+		max_bytes = (expected_bits + 7) / 8;
+	}
+
+	if (gap_running) {
+		while ((unsigned int)(timebase_now() - last_end) < GAP_TICKS)
+			;
+		gap_running = 0;
+	}
+
+	sreg = SREG;
+	if (GCN64_TRANSFER_US(data_out_len, max_bytes * 8) <= GCN64_MAX_HOLD_US) {
+		cli();
+	}
 	gcn64_sendBytes(data_out, data_out_len);
-	count = gcn64_receive();
-	if (!count)
+	count = gcn64_receive(max_bytes);
+	SREG = sreg;
+
+	last_end = timebase_now();
+	gap_running = 1;
+
+	if (!count) {
+		rx_high_offset = TIMING_OFFSET;
+		PROF_COUNT(PROF_CNT_JOYBUS_TIMEOUT);
 		return 0;
+	}
 
-	if (!(count & 0x01)) {
-		// If we don't get an odd number of level lengths from gcn64_receive
-		// something is wrong. 
-		//
-		// The stop bit is a short (~1us) low state followed by an "infinite"
-		// high state, which timeouts and lets the function return. This
-		// is why we should receive and odd number of lengths.
+	return count;
+}
+
+int gcn64_transaction(unsigned char *data_out, int data_out_len)
+{
+	return gcn64_transactionExpect(data_out, data_out_len, 0);
+}
+
+
+static char gcn64_replyOk(int count, int expected_bits, gcn64_check_fn check)
+{
+	if (!count) {
+		return 0; // Already counted as a timeout
+	}
+
+	if (count != expected_bits || (check && !check())) {
+		rx_high_offset = TIMING_OFFSET;
+		PROF_COUNT(PROF_CNT_JOYBUS_REJECT);
 		return 0;
 	}
 
-	gcn64_decodeWorkbuf(count);
-	
-	/* this delay is required on N64 controllers. Otherwise, after sending
-	 * a rumble-on or rumble-off command (probably init too), the following
-	 * get status fails. This starts to work at 2us. 5 should be safe. */
-	_delay_us(5);
-	
-	/* return the number of full bits received. */
-	return (count-1) / 2;
+	gcn64_calibrate();
+
+	return 1;
 }
 
+int gcn64_transactionChecked(unsigned char *data_out, int data_out_len, int expected_bits, gcn64_check_fn check)
+{
+	unsigned int start, cost;
+	int count;
+
+	start = timebase_now();
+	count = gcn64_transactionExpect(data_out, data_out_len, expected_bits);
+	if (gcn64_replyOk(count, expected_bits, check)) {
+		return count;
+	}
+
+	// A retry lasts about as long as the first attempt, plus the pause.
+	cost = timebase_now() - start + GAP_TICKS;
+	if (!phase_hasTime(cost)) {
+		return 0;
+	}
+
+	PROF_COUNT(PROF_CNT_JOYBUS_RETRY);
+	start = timebase_now();
+	count = gcn64_transactionExpect(data_out, data_out_len, expected_bits);
+	phase_addOptionalCost(timebase_now() - start);
+
+	if (gcn64_replyOk(count, expected_bits, check)) {
+		return count;
+	}
+
+	return 0;
+}
 
 #if (GC_GETID != 	N64_GET_CAPABILITIES)
 #error N64 vs GC detection commnad broken
@@ -361,6 +507,8 @@ int gcn64_detectController(void)
 	int count;
 	unsigned char nib;
 
+	// Maybe not the same controller: Back to the default timeout
+	rx_high_offset = TIMING_OFFSET;
 	count = gcn64_transaction(&tmp, 1);
 	if (count == 0) {
 		return CONTROLLER_IS_ABSENT;
@@ -422,15 +570,7 @@ int gcn64_detectController(void)
 	 *
 	 * */
 
-	nib = 0;
-	if (gcn64_workbuf[4])
-		nib |= 0x8;
-	if (gcn64_workbuf[5])
-		nib |= 0x4;
-	if (gcn64_workbuf[6])
-		nib |= 0x2;
-	if (gcn64_workbuf[7])
-		nib |= 0x1;
+	nib = gcn64_workbuf[0] & 0x0f;
 
 	switch(nib)
 	{
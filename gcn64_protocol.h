@@ -1,6 +1,8 @@
 #ifndef _gcn64_protocol_h__
 #define _gcn64_protocol_h__
 
+#include <string.h>
+
 #define CONTROLLER_IS_ABSENT	0
 #define CONTROLLER_IS_N64		1
 #define CONTROLLER_IS_GC		2
@@ -11,8 +13,10 @@
 #define N64_GET_CAPABILITIES		0x00
 #define N64_CAPS_REPLY_LENGTH		24
 
-#define OFFSET_EXT_REMOVED			22
-#define OFFSET_EXT_PRESENT			23
+/* In the third byte of the answer */
+#define N64_CAPS_EXT_BYTE			2
+#define N64_CAPS_EXT_REMOVED		0x02
+#define N64_CAPS_EXT_PRESENT		0x01
 
 /* Returns button states and axis values */
 #define N64_GET_STATUS				0x01
@@ -21,13 +25,26 @@
 /* Read from the expansion bus. */
 #define N64_EXPANSION_READ			0x02
 
-/* Write to the expansion bus. */
+/* Write to the expansion bus. The reply is the data checksum. */
 #define N64_EXPANSION_WRITE			0x03
+#define N64_EXPANSION_WRITE_REPLY_LENGTH	8
 
 /* Return information about controller. */
 #define GC_GETID					0x00
 #define GC_GETID_REPLY_LENGTH		24
 
+/* In the GC_GETID answer. First byte: */
+#define GC_ID_WIRELESS				0x80	// Wavebird receiver
+#define GC_ID_WIRELESS_RECEIVED		0x40	// Wavebird controller on
+/* Second byte (with the third: the controller ID): */
+#define GC_ID_WIRELESS_FIX			0x10	// Receiver fixed to that controller
+#define GC_ID_WIRELESS_ID_MASK		0xcf
+
+/* Wavebird: Fix the receiver to a controller ID (2 bytes, from the
+ * GC_GETID answer, with GC_ID_WIRELESS_FIX set). Answers like GC_GETID. */
+#define GC_FIX_DEVICE				0x4e
+#define GC_FIX_DEVICE_REPLY_LENGTH	24
+
 /* Return 80 bits, the first 64 have the same meaning as
  * the status command answer (see below), but with axis
  * at their origin. (buttons still work) */
@@ -41,11 +58,49 @@
 #define GC_GETSTATUS3(rumbling)		((rumbling) ? 0x01 : 0x00)
 #define GC_GETSTATUS_REPLY_LENGTH	64
 
+/* Longest reply: Expansion read (32 bytes + crc). Longer replies are
+ * truncated. */
+#define GCN64_MAX_REPLY_BYTES		33
+
 void gcn64protocol_hwinit(void);
 int gcn64_detectController(void);
+
+/* Send a command and receive the reply. Returns the number of bits
+ * received, 0 on timeout/error. Short transfers (GCN64_MAX_HOLD_US, see
+ * gcn64_protocol.c) are run with interrupts held, so a TWI event
+ * meanwhile only delays the wiimote (clock stretching). Requires the
+ * timebase. */
 int gcn64_transaction(unsigned char *data_out, int data_out_len);
 
+/* The same, with the reply length if known (0 otherwise). Reception then
+ * ends right after the stop bit instead of waiting for the end of reply
+ * timeout, and the transfer is short enough to hold interrupts more
+ * often. */
+int gcn64_transactionExpect(unsigned char *data_out, int data_out_len, int expected_bits);
+
+/* Decides if the reply in gcn64_workbuf can be used. Non-zero if so. */
+typedef char (*gcn64_check_fn)(void);
+
+/* gcn64_transaction() for reads that must not go wrong: The reply must
+ * be expected_bits long and pass check (if not NULL). A bad reply or a
+ * timeout is retried once, but only if there is still time before the
+ * next poll from the wiimote (see phase.c). Returns expected_bits, or 0
+ * when no good reply was received. */
+int gcn64_transactionChecked(unsigned char *data_out, int data_out_len, int expected_bits, gcn64_check_fn check);
+
+/* Received bits, 8 per byte, first bit in the most significant one */
 extern volatile unsigned char gcn64_workbuf[];
 
+/* Common to the N64 and GC status decoders: Copies the reply in
+ * gcn64_workbuf (packed, MSb first) to raw, and returns the 16 button
+ * bits from it. The N64_BTN_ and GC_BTN_ masks follow the reply layout,
+ * so this is a plain two byte load, no bit by bit work. The axes are
+ * then taken from raw as they are. */
+static inline unsigned short gcn64_decodeButtons(unsigned char *raw, unsigned char raw_size)
+{
+	memcpy(raw, (void*)gcn64_workbuf, raw_size);
+	return raw[0] | (raw[1] << 8);
+}
+
 #endif // _gcn64_protocol_h__
 
@@ -0,0 +1,22 @@
+#ifndef _host_avr_eeprom_h__
+#define _host_avr_eeprom_h__
+
+#include <stddef.h>
+#include <string.h>
+
+/* Host build: The EEPROM is a blank array in RAM */
+static unsigned char host_eeprom[512];
+
+#define eeprom_busy_wait()	do { } while(0)
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	memcpy(dst, host_eeprom + (size_t)src, n);
+}
+
+static inline void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+	memcpy(host_eeprom + (size_t)dst, src, n);
+}
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef _host_avr_interrupt_h__
+#define _host_avr_interrupt_h__
+
+#include <avr/io.h>
+
+#define sei()	do { } while(0)
+#define cli()	do { } while(0)
+
+#endif
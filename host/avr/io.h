@@ -0,0 +1,8 @@
+#ifndef _host_avr_io_h__
+#define _host_avr_io_h__
+
+/* Host build: The modules built here do not touch the hardware. They
+ * may save and restore the status register around cli(). */
+static unsigned char SREG __attribute__((unused));
+
+#endif
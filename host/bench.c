@@ -0,0 +1,504 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../gamepads.h"
+#include "../classic.h"
+#include "../analog.h"
+#include "../eeprom.h"
+#include "../n64.h"
+#include "../gamecube.h"
+#include "gcn64_host.h"
+
+#define SYNTH_FRAMES	4096
+#define MAX_FRAMES		65536
+
+/* One controller read. The bytes are what the controller returned:
+ *
+ * NES  : 1 byte (buttons)
+ * SNES : 2 bytes (low and high buttons byte)
+ * N64  : 4 bytes (GET_STATUS reply)
+ * GC   : 8 bytes (GETSTATUS reply)
+ */
+struct frame {
+	unsigned char data[8];
+};
+
+struct stream {
+	const char *name;
+	unsigned char pad_type;
+	int n_bytes;
+	int n_mappings;
+	struct frame *frames;
+	int n_frames;
+};
+
+static struct stream streams[] = {
+	{ "nes", PAD_TYPE_NES, 1, 1 },
+	{ "snes", PAD_TYPE_SNES, 2, 3 }, // normal, NES mode, analog dpad
+	{ "n64", PAD_TYPE_N64, 4, MODE_ODYSSEY + 1 },
+	{ "gc", PAD_TYPE_GAMECUBE, 8, MODE_GC_EXTRA1 + 1 },
+};
+#define N_STREAMS	(sizeof(streams) / sizeof(streams[0]))
+
+struct result {
+	char name[32];
+	unsigned long hash;
+	double decode_ns, map_ns, pack_ns;
+};
+
+static long clock_overhead_ns;
+
+/*** Synthetic input ***/
+
+static unsigned long rng_state;
+
+static unsigned long rng(void)
+{
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	rng_state &= 0xffffffff;
+	return rng_state;
+}
+
+/* Each bit set 1/8 of the time. Pressing everything at random
+ * would trigger the configuration combos constantly. */
+static unsigned char sparse8(void)
+{
+	return rng() & rng() & rng();
+}
+
+/* Sticks mostly move a little, sometimes jump */
+static int walk(int v, int min, int max)
+{
+	if ((rng() & 63) == 0) {
+		v = min + rng() % (max - min + 1);
+	} else {
+		v += (int)(rng() % 9) - 4;
+	}
+	if (v < min) v = min;
+	if (v > max) v = max;
+	return v;
+}
+
+static void synthesize(struct stream *s)
+{
+	int i, x=0, y=0, cx=0x80, cy=0x80, lt=0, rt=0;
+
+	s->frames = calloc(SYNTH_FRAMES, sizeof(struct frame));
+	if (!s->frames) {
+		perror("calloc");
+		exit(1);
+	}
+	s->n_frames = SYNTH_FRAMES;
+
+	rng_state = 0x12345678 ^ s->pad_type;
+
+	switch (s->pad_type)
+	{
+		case PAD_TYPE_GAMECUBE:
+			x = y = 0x80;
+			break;
+	}
+
+	for (i=0; i<s->n_frames; i++) {
+		unsigned char *d = s->frames[i].data;
+
+		switch (s->pad_type)
+		{
+			case PAD_TYPE_NES:
+				d[0] = sparse8();
+				break;
+
+			case PAD_TYPE_SNES:
+				d[0] = sparse8();
+				d[1] = sparse8() & 0xf0;
+				break;
+
+			case PAD_TYPE_N64:
+				x = walk(x, -85, 85);
+				y = walk(y, -85, 85);
+				d[0] = sparse8();
+				d[1] = sparse8() & 0x3f; // bits 8 and 9 are always 0
+				d[2] = x;
+				d[3] = y;
+				// Some third party controllers go there
+				if ((rng() & 255) == 0)
+					d[2] = 0x80;
+				break;
+
+			case PAD_TYPE_GAMECUBE:
+				x = walk(x, 0x20, 0xe0);
+				y = walk(y, 0x20, 0xe0);
+				cx = walk(cx, 0x20, 0xe0);
+				cy = walk(cy, 0x20, 0xe0);
+				lt = walk(lt, 0, 0xff);
+				rt = walk(rt, 0, 0xff);
+				d[0] = sparse8() & 0x1f; // bits 0-2 are 0
+				d[1] = 0x80 | (sparse8() & 0x7f); // bit 8 is 1
+				d[2] = x;
+				d[3] = y;
+				d[4] = cx;
+				d[5] = cy;
+				d[6] = lt;
+				d[7] = rt;
+				break;
+		}
+	}
+}
+
+/*** Recorded input ***/
+
+static struct stream *findStream(const char *name)
+{
+	unsigned int i;
+
+	for (i=0; i<N_STREAMS; i++) {
+		if (!strcmp(streams[i].name, name))
+			return &streams[i];
+	}
+	return NULL;
+}
+
+/* One frame per line: <nes|snes|n64|gc> <hex bytes>. # starts a comment. */
+static int loadRecording(const char *filename)
+{
+	FILE *fptr;
+	char line[256], name[16], hex[64];
+	int lineno = 0;
+	unsigned int i;
+
+	fptr = fopen(filename, "r");
+	if (!fptr) {
+		perror(filename);
+		return -1;
+	}
+
+	for (i=0; i<N_STREAMS; i++) {
+		streams[i].frames = calloc(MAX_FRAMES, sizeof(struct frame));
+		if (!streams[i].frames) {
+			perror("calloc");
+			exit(1);
+		}
+		streams[i].n_frames = 0;
+	}
+
+	while (fgets(line, sizeof(line), fptr)) {
+		struct stream *s;
+		struct frame *f;
+		int j;
+
+		lineno++;
+		if (line[0] == '#' || sscanf(line, "%15s %63s", name, hex) != 2)
+			continue;
+
+		s = findStream(name);
+		if (!s || (int)strlen(hex) != s->n_bytes * 2) {
+			fprintf(stderr, "%s:%d: bad frame\n", filename, lineno);
+			fclose(fptr);
+			return -1;
+		}
+		if (s->n_frames >= MAX_FRAMES)
+			continue;
+
+		f = &s->frames[s->n_frames++];
+		for (j=0; j<s->n_bytes; j++) {
+			unsigned int v;
+			sscanf(hex + j*2, "%2x", &v);
+			f->data[j] = v;
+		}
+	}
+
+	fclose(fptr);
+	return 0;
+}
+
+/*** Running ***/
+
+static long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static long elapsed(long start)
+{
+	long t = now_ns() - start - clock_overhead_ns;
+	return t < 0 ? 0 : t;
+}
+
+static void calibrateClock(void)
+{
+	long best = -1, t;
+	int i;
+
+	for (i=0; i<1000; i++) {
+		t = now_ns();
+		t = now_ns() - t;
+		if (best < 0 || t < best)
+			best = t;
+	}
+	clock_overhead_ns = best;
+}
+
+/* Same mapping for the whole run. The random input sometimes hits a
+ * mapping change combo, so it is enforced before every frame. */
+static void setMapping(unsigned char pad_type, int mapping)
+{
+	switch (pad_type)
+	{
+		case PAD_TYPE_SNES:
+			g_current_config.g_snes_nes_mode = (mapping == 1);
+			g_current_config.g_snes_analog_dpad = (mapping == 2);
+			break;
+		case PAD_TYPE_N64:
+			g_current_config.g_n64_mapping_mode = mapping;
+			break;
+		case PAD_TYPE_GAMECUBE:
+			g_current_config.g_gc_mapping_mode = mapping;
+			break;
+	}
+}
+
+/* Obtain a gamepad_data the way the firmware would. For N64 and
+ * Gamecube, this goes through the decoding code in n64.c and gamecube.c */
+static void readFrame(struct stream *s, Gamepad *pad, const struct frame *f, gamepad_data *dst)
+{
+	memset(dst, 0, sizeof(gamepad_data));
+
+	switch (s->pad_type)
+	{
+		case PAD_TYPE_NES:
+			dst->nes.pad_type = PAD_TYPE_NES;
+			dst->nes.buttons = f->data[0];
+			dst->nes.raw_data[0] = f->data[0];
+			break;
+
+		case PAD_TYPE_SNES:
+			dst->snes.pad_type = PAD_TYPE_SNES;
+			dst->snes.buttons = f->data[0] | (f->data[1] << 8);
+			dst->snes.raw_data[0] = f->data[0];
+			dst->snes.raw_data[1] = f->data[1];
+			break;
+
+		case PAD_TYPE_N64:
+			memcpy(gcn64_host.n64_status, f->data, 4);
+			pad->update();
+			pad->getReport(dst);
+			break;
+
+		case PAD_TYPE_GAMECUBE:
+			memcpy(gcn64_host.gc_status, f->data, 8);
+			pad->update();
+			pad->getReport(dst);
+			break;
+	}
+}
+
+static void run(struct stream *s, int mapping, int cmode, int style, struct result *res)
+{
+	Gamepad *pad = NULL;
+	gamepad_data data;
+	classic_pad_data classic;
+	unsigned char packed[PACKED_CLASSIC_DATA_SIZE];
+	unsigned long hash = 2166136261UL;
+	long decode_ns = 0, map_ns = 0, pack_ns = 0, t;
+	int i, j;
+
+	snprintf(res->name, sizeof(res->name), "%s.map%d.mode%d.style%d", s->name, mapping, cmode + 1, style);
+
+	memset(&gcn64_host, 0, sizeof(gcn64_host));
+	gcn64_host.caps[0] = 0x05; // No pack
+
+	switch (s->pad_type)
+	{
+		case PAD_TYPE_N64:
+			pad = n64GetGamepad();
+			memset(gcn64_host.n64_status, 0, 4);
+			pad->probe();
+			break;
+		case PAD_TYPE_GAMECUBE:
+			pad = gamecubeGetGamepad();
+			gcn64_host.caps[0] = 0x09; // GC_GETID: Standard controller
+			gcn64_host.caps[2] = 0x20;
+			// Centered, for the origins
+			memcpy(gcn64_host.gc_origins, "\x00\x80\x80\x80\x80\x80\x00\x00\x00\x00", 10);
+			pad->probe();
+			break;
+	}
+
+	disable_config = 0;
+	g_current_config.easy_triggers = 0;
+	g_current_config.merge_zl_zr = 0;
+
+	for (i=0; i<s->n_frames; i++) {
+		setMapping(s->pad_type, mapping);
+
+		t = now_ns();
+		readFrame(s, pad, &s->frames[i], &data);
+		decode_ns += elapsed(t);
+
+		// Like main.c: 1 and 2 for the first two reads, then 0.
+		t = now_ns();
+		dataToClassic(&data, &classic, i < 2 ? i + 1 : 0);
+		map_ns += elapsed(t);
+
+		t = now_ns();
+		pack_classic_data(&classic, packed, style, cmode);
+		pack_ns += elapsed(t);
+
+		// FNV-1a
+		for (j=0; j<PACKED_CLASSIC_DATA_SIZE; j++) {
+			hash ^= packed[j];
+			hash = (hash * 16777619UL) & 0xffffffff;
+		}
+	}
+
+	res->hash = hash;
+	if (s->n_frames) {
+		res->decode_ns = (double)decode_ns / s->n_frames;
+		res->map_ns = (double)map_ns / s->n_frames;
+		res->pack_ns = (double)pack_ns / s->n_frames;
+	}
+}
+
+/* Returns 0 if equal, 1 if different, -1 if unknown */
+static int checkGolden(FILE *golden, const struct result *res)
+{
+	char line[128], name[32];
+	unsigned long hash;
+
+	if (!golden)
+		return -1;
+
+	rewind(golden);
+	while (fgets(line, sizeof(line), golden)) {
+		if (sscanf(line, "%31s %lx", name, &hash) != 2)
+			continue;
+		if (!strcmp(name, res->name))
+			return hash != res->hash;
+	}
+
+	return -1;
+}
+
+static void usage(void)
+{
+	printf("Usage: ./bench [options]\n");
+	printf("\n");
+	printf("Runs dataToClassic and pack_classic_data over input streams for every\n");
+	printf("mapping, classic mode and analog style. Output hashes are compared\n");
+	printf("against a golden file.\n");
+	printf("\n");
+	printf(" -f file    Golden hashes to compare with (default: golden.txt)\n");
+	printf(" -g         Output golden hashes instead of checking\n");
+	printf(" -r file    Use recorded frames instead of synthetic input\n");
+	printf(" -h         Show this help\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *golden_file = "golden.txt";
+	const char *recording = NULL;
+	FILE *golden = NULL;
+	int generate = 0;
+	int failed = 0, unknown = 0, total = 0;
+	unsigned int i;
+	int opt, mapping, cmode, style;
+
+	while ((opt = getopt(argc, argv, "f:gr:h")) != -1) {
+		switch (opt)
+		{
+			case 'f': golden_file = optarg; break;
+			case 'g': generate = 1; break;
+			case 'r': recording = optarg; break;
+			case 'h': usage(); return 0;
+			default: usage(); return 1;
+		}
+	}
+
+	if (recording) {
+		if (loadRecording(recording))
+			return 1;
+	} else {
+		for (i=0; i<N_STREAMS; i++) {
+			synthesize(&streams[i]);
+		}
+	}
+
+	if (!generate) {
+		golden = fopen(golden_file, "r");
+		if (!golden) {
+			perror(golden_file);
+			return 1;
+		}
+		printf("%-24s %-8s %8s %8s %8s  (ns/frame)\n", "run", "hash", "decode", "map", "pack");
+	}
+
+	calibrateClock();
+	init_config();
+
+	for (i=0; i<N_STREAMS; i++) {
+		struct stream *s = &streams[i];
+
+		if (!s->n_frames)
+			continue;
+
+		for (mapping=0; mapping<s->n_mappings; mapping++) {
+			for (cmode=CLASSIC_MODE_1; cmode<=CLASSIC_MODE_3; cmode++) {
+				for (style=ANALOG_STYLE_DEFAULT; style<=ANALOG_STYLE_GC; style++) {
+					struct result res;
+					const char *status = "";
+
+					run(s, mapping, cmode, style, &res);
+					total++;
+
+					if (generate) {
+						printf("%s %08lx\n", res.name, res.hash);
+						continue;
+					}
+
+					switch (checkGolden(golden, &res))
+					{
+						case 0: break;
+						case 1: status = " MISMATCH"; failed++; break;
+						default: status = " (no golden)"; unknown++; break;
+					}
+
+					printf("%-24s %08lx %8.1f %8.1f %8.1f%s\n", res.name, res.hash,
+						res.decode_ns, res.map_ns, res.pack_ns, status);
+				}
+			}
+		}
+	}
+
+	if (golden) {
+		fclose(golden);
+		printf("%d runs, %d mismatch, %d without golden hash\n", total, failed, unknown);
+	}
+
+	return failed ? 1 : 0;
+}
+
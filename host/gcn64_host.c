@@ -0,0 +1,85 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "../gcn64_protocol.h"
+#include "gcn64_host.h"
+
+/* Stands in for gcn64_protocol.c: Instead of talking to a controller,
+ * the replies from gcn64_host are placed in gcn64_workbuf exactly as
+ * the real receive code would leave them. */
+
+volatile unsigned char gcn64_workbuf[GCN64_MAX_REPLY_BYTES];
+
+struct gcn64_host_pad gcn64_host;
+
+static int reply(const unsigned char *bytes, int n_bytes)
+{
+	// Packed, as received
+	memcpy((void*)gcn64_workbuf, bytes, n_bytes);
+
+	return n_bytes * 8;
+}
+
+void gcn64protocol_hwinit(void)
+{
+}
+
+int gcn64_transaction(unsigned char *data_out, int data_out_len)
+{
+	static const unsigned char expansion_ack = 0xb8;
+
+	if (gcn64_host.absent || data_out_len < 1)
+		return 0;
+
+	switch (data_out[0])
+	{
+		case N64_GET_CAPABILITIES:
+			return reply(gcn64_host.caps, sizeof(gcn64_host.caps));
+
+		case N64_GET_STATUS:
+			return reply(gcn64_host.n64_status, sizeof(gcn64_host.n64_status));
+
+		case N64_EXPANSION_WRITE:
+			return reply(&expansion_ack, 1);
+
+		case GC_GETSTATUS1:
+			return reply(gcn64_host.gc_status, sizeof(gcn64_host.gc_status));
+
+		case GC_GET_ORIGINS:
+			return reply(gcn64_host.gc_origins, sizeof(gcn64_host.gc_origins));
+	}
+
+	return 0;
+}
+
+int gcn64_transactionExpect(unsigned char *data_out, int data_out_len, int expected_bits)
+{
+	return gcn64_transaction(data_out, data_out_len);
+}
+
+/* Nothing goes wrong here, so there is never a retry */
+int gcn64_transactionChecked(unsigned char *data_out, int data_out_len, int expected_bits, gcn64_check_fn check)
+{
+	int count;
+
+	count = gcn64_transaction(data_out, data_out_len);
+	if (count != expected_bits || (check && !check()))
+		return 0;
+
+	return count;
+}
+
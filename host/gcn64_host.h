@@ -0,0 +1,17 @@
+#ifndef _gcn64_host_h__
+#define _gcn64_host_h__
+
+/* Replies the fake controller gives to each command. Set them
+ * before calling the gamepad update function. */
+struct gcn64_host_pad {
+	unsigned char caps[3];			// N64_GET_CAPABILITIES / GC_GETID
+	unsigned char n64_status[4];	// N64_GET_STATUS
+	unsigned char gc_status[8];		// GC_GETSTATUS
+	unsigned char gc_origins[10];	// GC_GET_ORIGINS
+	char absent;					// When set, nothing answers
+};
+
+extern struct gcn64_host_pad gcn64_host;
+
+#endif // _gcn64_host_h__
+
@@ -0,0 +1,8 @@
+#ifndef _host_util_delay_h__
+#define _host_util_delay_h__
+
+/* Host build: Delays are only there for the real controllers. */
+#define _delay_us(us)	do { } while(0)
+#define _delay_ms(ms)	do { } while(0)
+
+#endif
@@ -28,6 +28,10 @@
 #include "classic.h"
 #include "analog.h"
 #include "db9.h"
+#include "timebase.h"
+#include "phase.h"
+#include "profile.h"
+#include "cpak.h"
 
 static unsigned char classic_id[6] = { 0x00, 0x00, 0xA4, 0x20, 0x01, 0x01 };
 #ifndef DB9_V2
@@ -129,6 +133,12 @@ static void hwInit(void)
 		DDRB = 0x00;
 		PORTB = 0xff;
 	}
+
+	// Turn off what is not used. This mostly helps in idle sleep.
+	ACSR = _BV(ACD);
+#ifdef PRR
+	PRR = _BV(PRTIM0) | _BV(PRTIM2) | _BV(PRSPI) | _BV(PRUSART0) | _BV(PRADC);
+#endif
 }
 
 static char initial_controller = PAD_TYPE_NONE;
@@ -149,11 +159,17 @@ static void do_earlyDetection()
 		case CONTROLLER_IS_N64:
 			initial_controller = PAD_TYPE_N64;
 			wm_setAltId(adapter_n64_id);
+#ifdef WITH_N64
+			n64UseDetectionReply();
+#endif
 			return;
 
 		case CONTROLLER_IS_GC:
 			initial_controller = PAD_TYPE_GAMECUBE;
 			wm_setAltId(adapter_gc_id);
+#ifdef WITH_GAMECUBE
+			gamecubeUseDetectionReply();
+#endif
 			return;
 	}
 #endif
@@ -184,9 +200,174 @@ static void do_earlyDetection()
 
 static void pollfunc(void)
 {
+	phase_pollEvent();
+	prof_pollEvent();
 	performupdate = 1;
 }
 
+#ifdef WITH_FRESH_REPORT
+/* Fresh reports, for NES/SNES controllers: Rather than publishing a
+ * report read ahead of the wiimote poll (up to a poll period old when
+ * sent), the controller is read, mapped and packed when the wiimote
+ * starts reading the report, while it waits. Only worth it with a fast
+ * read (SNES_HALF_PERIOD_US, see snes.h).
+ *
+ * All of it runs in the TWI interrupt, with the clock stretched: That is
+ * the point (the report is as fresh as the read), and why the whole is
+ * kept to FRESH_MAX_STRETCH_US. The main loop does the work as usual and
+ * measures the mapping and packing. When they fit with the slowest read
+ * the settings allow (snesFreshMaxTicks(), computed), freshReport() takes
+ * over. It checks that bound again before each read, gives up when the
+ * read went over anyway or hit a glitch (no slow read again there), and
+ * the report is left as is. The main loop then takes over again, for
+ * FRESH_RETRY_FRAMES at least.
+ *
+ * Not run in the simulator yet (make fresh, see sim/README). */
+#ifndef FRESH_MAX_STRETCH_US
+#define FRESH_MAX_STRETCH_US	400
+#endif
+#define FRESH_MAX_TICKS			TIMEBASE_US_TO_TICKS(FRESH_MAX_STRETCH_US)
+#define FRESH_RETRY_FRAMES		200
+
+// Set by the main loop only, cleared by either
+static volatile char fresh_active;
+
+// Snapshots from the main loop
+static Gamepad *fresh_pad;
+static unsigned char fresh_style, fresh_mode, fresh_first_read;
+static unsigned int fresh_pack_ticks;
+
+static void freshReport(void)
+{
+	gamepad_data data;
+	classic_pad_data classic;
+	unsigned int start;
+
+	if (!fresh_active)
+		return;
+
+	start = timebase_now();
+	if (snesFreshMaxTicks() + fresh_pack_ticks > FRESH_MAX_TICKS || snesFreshUpdate()) {
+		fresh_active = 0;
+		return;
+	}
+	fresh_pad->getReport(&data);
+
+	if ((unsigned int)(timebase_now() - start) + fresh_pack_ticks > FRESH_MAX_TICKS) {
+		fresh_active = 0;
+		return;
+	}
+
+	config_deferSync(1);
+	dataToClassic(&data, &classic, fresh_first_read);
+	config_deferSync(0);
+	pack_classic_data(&classic, wm_getReportBuffer(), fresh_style, fresh_mode);
+	wm_publishReport();
+}
+#else
+#define fresh_active	0
+#endif
+
+#ifdef WITH_OVERSAMPLE
+/* Oversampling, for NES/SNES and DB9 controllers: With one read per
+ * poll, a short press (a tap, a turbo button) may fall between two reads.
+ * The controller is also sampled every OVERSAMPLE_PERIOD_US while the
+ * main loop would sleep. Presses seen by a sample are kept until the next
+ * update (see the sample function in gamepads.h), releases are as of the
+ * update.
+ *
+ * A sample is only taken before the update if it ends in time (measured,
+ * the longest one counts), so the update is never pushed back. */
+#ifndef OVERSAMPLE_PERIOD_US
+#define OVERSAMPLE_PERIOD_US	1000
+#endif
+#define OVERSAMPLE_TICKS		TIMEBASE_US_TO_TICKS(OVERSAMPLE_PERIOD_US)
+
+static Gamepad *sample_pad;
+static unsigned int next_sample;
+static unsigned int sample_cost;
+static unsigned int frame_sample_ticks;
+
+static char sampleDue(void)
+{
+	unsigned int now;
+
+	if (!sample_pad)
+		return 0;
+
+	// Not sampled for a while, the timestamp may look ahead
+	now = timebase_now();
+	if ((int)(next_sample - now) > (int)OVERSAMPLE_TICKS) {
+		next_sample = now;
+	}
+
+	return (int)(next_sample - now) <= 0;
+}
+
+static void takeSample(void)
+{
+	unsigned int start, t;
+
+	start = timebase_now();
+	sample_pad->sample();
+	t = timebase_now() - start;
+
+	if (t > sample_cost)
+		sample_cost = t;
+	frame_sample_ticks += t;
+	next_sample = start + OVERSAMPLE_TICKS;
+}
+
+/* Sleep until the next poll, waking up for the samples */
+static void oversampleWaitPoll(void)
+{
+	cli();
+	while (!performupdate) {
+		if (sampleDue()) {
+			sei();
+			takeSample();
+			cli();
+			continue;
+		}
+		if (sample_pad) {
+			timebase_setWakeup(next_sample);
+			if ((int)(next_sample - TCNT1) > 0) {
+				timebase_sleep();
+			}
+			timebase_clearWakeup();
+		} else {
+			timebase_sleep();
+		}
+	}
+	sei();
+}
+
+/* Like timebase_sleepUntil(), waking up for the samples that fit */
+static void oversampleUntil(unsigned int when)
+{
+	unsigned int wake;
+
+	while ((int)(when - timebase_now()) > 0) {
+		if (sampleDue() && (int)(when - timebase_now()) > (int)sample_cost) {
+			takeSample();
+			continue;
+		}
+
+		cli();
+		wake = when;
+		if (sample_pad && (int)(next_sample - when) < 0 && (int)(next_sample - TCNT1) > 0) {
+			wake = next_sample;
+		}
+		timebase_setWakeup(wake);
+		if ((int)(wake - TCNT1) > 0) {
+			timebase_sleep();
+		}
+		timebase_clearWakeup();
+		sei();
+	}
+}
+#endif
+
 #define ERROR_THRESHOLD			10
 
 #define STATE_NO_CONTROLLER		0
@@ -194,6 +375,45 @@ static void pollfunc(void)
 
 #define N64_GC_DETECT_PERIOD	120
 
+/* Sends a pending N64 rumble pak write right before 'until', if it fits.
+ * Returns non-zero if the slot was used.
+ *
+ * Until the poll period is known, 'until' (the fallback delay A) is the
+ * only time known to be clear of the I2C burst: The write is sent then
+ * and delays the read, still well within the period.
+ *
+ * Either way, a new rumble state is on the pad at most one poll period
+ * plus delay A after the wiimote wrote it, 7.35ms with 5ms polls, or one
+ * frame more after a failed write. Computed, not measured. */
+static char rumbleSlot(unsigned int until)
+{
+#ifdef WITH_N64
+	unsigned int start;
+
+	if (!n64RumblePending()) {
+		return 0;
+	}
+
+	if (!phase_isLocked()) {
+		timebase_sleepUntil(until);
+		start = timebase_now();
+		n64UpdateRumble();
+		phase_addOptionalCost(timebase_now() - start);
+		return 1;
+	}
+
+	start = until - TIMEBASE_US_TO_TICKS(N64_RUMBLE_WRITE_US);
+	if ((int)(start - timebase_now()) < 0) {
+		return 0;
+	}
+	timebase_sleepUntil(start);
+	n64UpdateRumble();
+	return 1;
+#else
+	return 0;
+#endif
+}
+
 int main(void)
 {
 	Gamepad *snes_gamepad = NULL;
@@ -210,8 +430,21 @@ int main(void)
 	int error_count = 0;
 	char first_controller_read=0;
 	int detect_time = 0;
+	unsigned int update_start;
+	unsigned char rumble, last_rumble = 0xff;
+	unsigned int rumble_time;
+	char n64_active;
+	char fresh_frame;
+#ifdef WITH_FRESH_REPORT
+	unsigned int pack_start;
+	unsigned char fresh_retry = 0;
+#endif
+	PROF_DECLARE(prof_t);
 
 	hwInit();
+	timebase_init();
+	prof_init();
+	cpak_init();
 	init_config();
 #if defined(WITH_N64) || defined(WITH_GAMECUBE)
 	gcn64protocol_hwinit();
@@ -243,9 +476,31 @@ int main(void)
 
 	if (!db9_mode) {
 		do_earlyDetection();
+
+		// Start with the N64 or GC controller found above instead of
+		// detecting it again in the main loop.
+		switch (initial_controller)
+		{
+			case PAD_TYPE_N64:
+				cur_gamepad = n64_gamepad;
+				analog_style = ANALOG_STYLE_N64;
+				break;
+			case PAD_TYPE_GAMECUBE:
+				cur_gamepad = gc_gamepad;
+				analog_style = ANALOG_STYLE_GC;
+				break;
+		}
+		if (cur_gamepad) {
+			mainState = STATE_CONTROLLER_ACTIVE;
+			first_controller_read = 1;
+		}
 	}
 
 	wm_init(classic_id, current_report, PACKED_CLASSIC_DATA_SIZE, cal_data, pollfunc);
+#ifdef WITH_FRESH_REPORT
+	fresh_pad = snes_gamepad;
+	wm_setFreshReportFunc(freshReport);
+#endif
 	wm_start();
 	sei();
 
@@ -253,28 +508,52 @@ int main(void)
 	{
 		// Adapter without sleep: 4mA
 		// Adapter with sleep: 1.6mA
-
-		set_sleep_mode(SLEEP_MODE_EXT_STANDBY);
-		sleep_enable();
-		sleep_cpu();
-		sleep_disable();
-
-		while (!performupdate) { }
+		//
+		// Timer1 (the timebase) does not run in EXT_STANDBY. Builds that
+		// need it between polls (phase tracking for N64/GC, profiler,
+		// oversampling) idle sleep here. The others keep EXT_STANDBY, the
+		// mode the figures above are from. Delay A (below) is always an
+		// idle sleep. Neither the current in idle mode nor the awake duty
+		// cycle has been measured yet, for any target. The awake
+		// percentage can be read with the profiler (page 0, see
+		// profile.h); the current needs a meter.
+#ifdef WITH_OVERSAMPLE
+		// Not with fresh reports: The interrupt reads the controller then.
+		sample_pad = NULL;
+		if (mainState == STATE_NO_CONTROLLER && !fresh_active &&
+				default_gamepad && default_gamepad->sample) {
+			sample_pad = default_gamepad;
+		}
+		oversampleWaitPoll();
+#elif defined(PHASE_TRACKING) || defined(WITH_PROFILER)
+		cli();
+		while (!performupdate) {
+			timebase_sleep();
+		}
+		sei();
+#else
+		cli();
+		while (!performupdate) {
+			timebase_standby();
+		}
+		sei();
+#endif
 		performupdate = 0;
+		PROF_WAKE(prof_t);
 
-		// With this delay, the controller read is postponed until just before
-		// the next I2C read from the wiimote. This is to reduce latency to a
-		// minimum (2.2ms at the moment).
+		// The controller read is postponed until just before the next I2C
+		// read from the wiimote. This is to reduce latency to a minimum.
 		//
-		// The N64 or Gamecube controller read will be corrupted if interrupted
-		// by an I2C interrupt. The timing of the I2C read varies (menu vs in-game)
-		// so we have to be careful not to let the N64/GC transaction overlap
-		// with the I2C communication..
+		// The N64 or Gamecube controller read runs with interrupts held,
+		// so an I2C byte arriving meanwhile is stretched until it ends
+		// (up to about 0.4ms for a GC status) instead of corrupting it. The
+		// timing of the I2C read varies (menu vs in-game) and stretching
+		// is best avoided, so we still try not to let the N64/GC
+		// transaction overlap with the I2C communication..
 		//
-		// This is why I chose to maintain a margin.
+		// A used to be a fixed 2.35ms delay. phase.c now measures B and D and
+		// times A so the read completes PHASE_MARGIN_US before the next burst.
 		//
-		_delay_ms(2.35); // delay A
-
 		//                                        |<----------- E ----------->|
 		//                               C  -->|  |<--
 		//         ____________________________    ________  / ______________________ ...
@@ -285,12 +564,51 @@ int main(void)
 		//              |<---- D --->|
 		//                      |<----- A ---->|
 		//              |<-------------------B------------------>|
-		// A = 2.35ms (Configured above)
+		// A = Computed by phase_getUpdateTime() (2.35ms until B is known)
 		// B = 5ms (Wiimote classic controller poll rate)
 		// C = 0.4ms (GC controller poll time)
 		// D = 1.2ms, 1.1ms, 1.5ms (Wiimote I2C communication time. Varies [menu/game])
 		// E = 2.34ms (menu), 2.84ms (in game)
 		//
+		update_start = phase_getUpdateTime();
+
+		// Rumble register (see classic.c). The new state is sent to a
+		// controller once, and again to the next one connected. A
+		// Gamecube controller gets it with the next status read (within
+		// B). An N64 rumble pak gets it below, next frame at the latest.
+		rumble = wm_getRumble(&rumble_time) ? 1 : 0;
+		if (mainState != STATE_CONTROLLER_ACTIVE) {
+			last_rumble = 0xff;
+		} else if (rumble != last_rumble) {
+			if (last_rumble != 0xff) {
+				PROF_RUMBLE_REQUEST(rumble_time);
+			}
+			last_rumble = rumble;
+			if (cur_gamepad->setVibration) {
+				cur_gamepad->setVibration(rumble);
+			}
+		}
+
+		// Rumble pak writes, or else Controller Pak transfers, use the
+		// end of A (one per frame, see cpak.h)
+		n64_active = mainState == STATE_CONTROLLER_ACTIVE && cur_gamepad == n64_gamepad;
+		if (!(n64_active && rumbleSlot(update_start))) {
+			cpak_frame(n64_active, update_start);
+		}
+#ifdef WITH_OVERSAMPLE
+		oversampleUntil(update_start); // delay A
+		if (sample_pad) {
+			PROF_TICKS(PROF_STAGE_SAMPLE, frame_sample_ticks);
+		}
+		frame_sample_ticks = 0;
+#else
+		timebase_sleepUntil(update_start); // delay A
+#endif
+		PROF_MARK(prof_t);
+
+		// The interrupt may give up fresh reports anytime. This frame
+		// does not touch the controller nor the report if they were on.
+		fresh_frame = fresh_active;
 
 		switch(mainState)
 		{
@@ -307,24 +625,31 @@ int main(void)
 					if (detect_time > N64_GC_DETECT_PERIOD)
 					{
 						detect_time = 0;
+						PROF_COUNT(PROF_CNT_DETECT);
 						switch (gcn64_detectController())
 						{
 							case CONTROLLER_IS_N64:
 								cur_gamepad = n64_gamepad;
 								mainState = STATE_CONTROLLER_ACTIVE;
 								analog_style = ANALOG_STYLE_N64;
+#ifdef WITH_N64
+								n64UseDetectionReply();
+#endif
 								break;
 
 							case CONTROLLER_IS_GC:
 								cur_gamepad = gc_gamepad;
 								mainState = STATE_CONTROLLER_ACTIVE;
 								analog_style = ANALOG_STYLE_GC;
+#ifdef WITH_GAMECUBE
+								gamecubeUseDetectionReply();
+#endif
 								break;
 						}
 					}
 				}
 #endif
-				if (default_gamepad) {
+				if (default_gamepad && !fresh_frame) {
 					default_gamepad->update();
 					default_gamepad->getReport(&lastReadData);
 				}
@@ -333,8 +658,10 @@ int main(void)
 			case STATE_CONTROLLER_ACTIVE:
 				if (cur_gamepad->update()) {
 					error_count++;
-					if (error_count > 10)
+					if (error_count > 10) {
 						mainState = STATE_NO_CONTROLLER;
+						PROF_COUNT(PROF_CNT_CONTROLLER_LOST);
+					}
 					break;
 				}
 				error_count = 0;
@@ -344,6 +671,16 @@ int main(void)
 				break;
 		}
 
+		phase_setUpdateCost(timebase_now() - update_start);
+		PROF_STAGE(PROF_STAGE_UPDATE, prof_t);
+
+#ifdef WITH_FRESH_REPORT
+		// Another controller, or raw reports: Back to the main loop
+		if (mainState != STATE_NO_CONTROLLER || wm_altIdEnabled()) {
+			fresh_active = 0;
+		}
+#endif
+
 		if (!wm_altIdEnabled())
 		{
 			unsigned char mode;
@@ -356,12 +693,41 @@ int main(void)
 				case 0x02: mode = CLASSIC_MODE_2; break;
 			}
 
+#ifdef WITH_FRESH_REPORT
+			fresh_style = analog_style;
+			fresh_mode = mode;
+			fresh_first_read = first_controller_read;
+			config_syncPending();
+			if (fresh_frame) {
+				prof_frame();
+				continue;
+			}
+			pack_start = timebase_now();
+#endif
 			dataToClassic(&lastReadData, &classicData, first_controller_read);
 			if (first_controller_read > 2) {
 				first_controller_read = 0;
 			}
-			pack_classic_data(&classicData, current_report, analog_style, mode);
-			wm_newaction(current_report, PACKED_CLASSIC_DATA_SIZE);
+			PROF_STAGE(PROF_STAGE_MAP, prof_t);
+			pack_classic_data(&classicData, wm_getReportBuffer(), analog_style, mode);
+			PROF_STAGE(PROF_STAGE_PACK, prof_t);
+			wm_publishReport();
+			PROF_STAGE(PROF_STAGE_PUBLISH, prof_t);
+
+#ifdef WITH_FRESH_REPORT
+			// Take over if the NES/SNES controller is read and this
+			// all fits (packing measured with interrupts, so on the
+			// safe side)
+			if (fresh_retry) {
+				fresh_retry--;
+			} else if (mainState == STATE_NO_CONTROLLER && !db9_mode && default_gamepad == snes_gamepad) {
+				fresh_pack_ticks = timebase_now() - pack_start;
+				if (snesFreshMaxTicks() + fresh_pack_ticks <= FRESH_MAX_TICKS) {
+					fresh_active = 1;
+				}
+				fresh_retry = FRESH_RETRY_FRAMES;
+			}
+#endif
 		}
 		else
 		{
@@ -369,8 +735,10 @@ int main(void)
 
 			// Changing controller is not possible in this mode
 			// unless we control the device_detect line.
-			if (lastReadData.pad_type != initial_controller)
-				 continue;
+			if (lastReadData.pad_type != initial_controller) {
+				prof_frame();
+				continue;
+			}
 
 			switch (initial_controller)
 			{
@@ -395,8 +763,12 @@ int main(void)
 					break;
 			}
 
+			PROF_STAGE(PROF_STAGE_PUBLISH, prof_t);
+
 			// TODO : Controller specific report format
 		}
+
+		prof_frame();
 	}
 
 	return 0;
@@ -26,6 +26,7 @@
 #include "gamepads.h"
 #include "n64.h"
 #include "gcn64_protocol.h"
+#include "profile.h"
 
 /*********** prototypes *************/
 static char n64Init(void);
@@ -51,42 +52,78 @@ static char n64Init(void)
 #define RSTATE_TURNOFF		4
 #define RSTATE_UNAVAILABLE	5
 static unsigned char n64_rumble_state = RSTATE_UNAVAILABLE;
-
-static char n64Update(void)
+static unsigned char n64_rumble_wanted;
+
+/* Drop status replies with bit 9 (always 0) set. Bit 8 is not checked,
+ * the controller sets it during the L+R+Start reset combo. Build with
+ * -DN64_CHECK_FIXED_BITS=0 to accept everything. */
+#ifndef N64_CHECK_FIXED_BITS
+#define N64_CHECK_FIXED_BITS	1
+#endif
+
+/* Pak presence is watched with N64_GET_CAPABILITIES. Not on every frame,
+ * as this would nearly double the time on the bus: Only every
+ * N64_CAPS_PERIOD frames, and on the frame after a failed read. With the
+ * wiimote polling every 5ms, a pak insertion or removal is noticed within
+ * N64_CAPS_PERIOD * 5ms (80ms by default), and the rumble pak is ready
+ * one frame later. */
+#ifndef N64_CAPS_PERIOD
+#define N64_CAPS_PERIOD		16
+#endif
+static unsigned char caps_countdown;
+
+static char n64_checkStatus(void)
 {
-	int i;
-	unsigned char tmpdata[38];
-	unsigned char count;
+#if N64_CHECK_FIXED_BITS
+	if (gcn64_workbuf[1] & 0x40)
+		return 0;
+#endif
 
+	return 1;
+}
 
-	/* Pad answer to N64_GET_CAPABILITIES
-	 *
-	 * 0x050000 : 0000 0101 0000 0000 0000 0000 : No expansion pack
-	 * 0x050001 : 0000 0101 0000 0000 0000 0001 : With expansion pack
-	 * 0x050002 : 0000 0101 0000 0000 0000 0010 : Expansion pack removed
-	 *
-	 * Bit 0 tells us if there is something connected to the expansion port.
-	 * Bit 1 tells is if there was something connected that has been removed.
-	 */
-	tmpdata[0] = N64_GET_CAPABILITIES;
-	count = gcn64_transaction(tmpdata, 1);
-	if (count != N64_CAPS_REPLY_LENGTH) {
-		// a failed read could mean the pack or controller was gone. Init
-		// will be necessary next time we detect a pack is present.
-		n64_rumble_state = RSTATE_INIT;
-		return -1;
-	}
-
+/* Pad answer to N64_GET_CAPABILITIES (in gcn64_workbuf)
+ *
+ * 0x050000 : 0000 0101 0000 0000 0000 0000 : No expansion pack
+ * 0x050001 : 0000 0101 0000 0000 0000 0001 : With expansion pack
+ * 0x050002 : 0000 0101 0000 0000 0000 0010 : Expansion pack removed
+ *
+ * Bit 0 tells us if there is something connected to the expansion port.
+ * Bit 1 tells is if there was something connected that has been removed.
+ */
+static void n64_decodeCaps(void)
+{
 	/* Detect when a pack becomes present and schedule initialisation when it happens. */
-	if (gcn64_workbuf[OFFSET_EXT_PRESENT] && (n64_rumble_state == RSTATE_UNAVAILABLE)) {
+	if ((gcn64_workbuf[N64_CAPS_EXT_BYTE] & N64_CAPS_EXT_PRESENT) && (n64_rumble_state == RSTATE_UNAVAILABLE)) {
 		n64_rumble_state = RSTATE_INIT;
 	}
 
 	/* Detect when a pack is removed. */
-	if (!gcn64_workbuf[OFFSET_EXT_PRESENT]) {
+	if (!(gcn64_workbuf[N64_CAPS_EXT_BYTE] & N64_CAPS_EXT_PRESENT)) {
 		n64_rumble_state = RSTATE_UNAVAILABLE;
 	}
 
+	caps_countdown = N64_CAPS_PERIOD;
+}
+
+void n64UseDetectionReply(void)
+{
+	n64_rumble_state = RSTATE_UNAVAILABLE;
+	n64_decodeCaps();
+}
+
+char n64RumblePending(void)
+{
+	return n64_rumble_state == RSTATE_INIT ||
+			n64_rumble_state == RSTATE_TURNON ||
+			n64_rumble_state == RSTATE_TURNOFF;
+}
+
+void n64UpdateRumble(void)
+{
+	unsigned char tmpdata[38];
+	unsigned char count;
+
 	switch (n64_rumble_state)
 	{
 		case RSTATE_INIT:
@@ -94,10 +131,10 @@ static char n64Update(void)
 			tmpdata[1] = 0x80;
 			tmpdata[2] = 0x01;
 			memset(tmpdata+3, 0x80, 34);
-			count = gcn64_transaction(tmpdata, 35);
+			count = gcn64_transactionExpect(tmpdata, 35, N64_EXPANSION_WRITE_REPLY_LENGTH);
 			if (count > 0) {
 				/* Answer: 1011 1000 (0xb8) */
-				n64_rumble_state = RSTATE_TURNOFF;
+				n64_rumble_state = n64_rumble_wanted ? RSTATE_TURNON : RSTATE_TURNOFF;
 			}
 			break;
 
@@ -106,9 +143,10 @@ static char n64Update(void)
 			tmpdata[1] = 0xc0;
 			tmpdata[2] = 0x1b;
 			memset(tmpdata+3, 0x01, 32);
-			count = gcn64_transaction(tmpdata, 35);
+			count = gcn64_transactionExpect(tmpdata, 35, N64_EXPANSION_WRITE_REPLY_LENGTH);
 			if (count > 0) {
 				n64_rumble_state = RSTATE_ON;
+				PROF_RUMBLE_SENT();
 			}
 			break;
 
@@ -117,16 +155,39 @@ static char n64Update(void)
 			tmpdata[1] = 0xc0;
 			tmpdata[2] = 0x1b;
 			memset(tmpdata+3, 0x00, 32);
-			count = gcn64_transaction(tmpdata, 35);
+			count = gcn64_transactionExpect(tmpdata, 35, N64_EXPANSION_WRITE_REPLY_LENGTH);
 			if (count > 0) {
 				n64_rumble_state = RSTATE_OFF;
+				PROF_RUMBLE_SENT();
 			}
 			break;
 	}
+}
+
+static char n64Update(void)
+{
+	unsigned char tmpdata[38];
+	unsigned char count;
+
+	if (!caps_countdown) {
+		tmpdata[0] = N64_GET_CAPABILITIES;
+		count = gcn64_transactionChecked(tmpdata, 1, N64_CAPS_REPLY_LENGTH, NULL);
+		if (count != N64_CAPS_REPLY_LENGTH) {
+			// a failed read could mean the pack or controller was gone.
+			// n64_decodeCaps() schedules init when a pack is seen again.
+			// Until then, no expansion write (see n64RumblePending).
+			n64_rumble_state = RSTATE_UNAVAILABLE;
+			return -1;
+		}
+		n64_decodeCaps();
+	}
+	caps_countdown--;
 
 	tmpdata[0] = N64_GET_STATUS;
-	count = gcn64_transaction(tmpdata, 1);
+	count = gcn64_transactionChecked(tmpdata, 1, N64_GET_STATUS_REPLY_LENGTH, n64_checkStatus);
 	if (count != N64_GET_STATUS_REPLY_LENGTH) {
+		// Maybe the pak was pulled out. Check next time.
+		caps_countdown = 0;
 		return -1;
 	}
 
@@ -153,24 +214,10 @@ static char n64Update(void)
  */
 
 	last_built_report.pad_type = PAD_TYPE_N64;
-	last_built_report.n64.buttons = 0;
-
-	for (i=0; i<16; i++) {
-		if (gcn64_workbuf[i]) {
-			last_built_report.n64.buttons |= 1<<i;
-		}
-	}
+	last_built_report.n64.buttons = gcn64_decodeButtons(last_built_report.n64.raw_data, N64_RAW_SIZE);
 
-	tmpdata[0] = 0;
-	tmpdata[1] = 0;
-	for (i=0; i<8; i++) // X axis
-		tmpdata[0] |= gcn64_workbuf[i+16] ? (0x80>>i) : 0;
-
-	for (i=0; i<8; i++) // Y axis
-		tmpdata[1] |= gcn64_workbuf[i+24] ? (0x80>>i) : 0;
-
-	last_built_report.n64.x = tmpdata[0];
-	last_built_report.n64.y = tmpdata[1];
+	last_built_report.n64.x = last_built_report.n64.raw_data[2];
+	last_built_report.n64.y = last_built_report.n64.raw_data[3];
 
 	/* Some cheap non-official controllers
 	 * use the full 8 bit range instead of the
@@ -196,14 +243,6 @@ static char n64Update(void)
 	if (last_built_report.n64.y == -128)
 		last_built_report.n64.y = -127;
 
-	// Copy all the data as-is for the raw field
-	memset(last_built_report.n64.raw_data, 0, N64_RAW_SIZE);
-	for (i=0; i<32; i++) {
-		if (gcn64_workbuf[i]) {
-			last_built_report.n64.raw_data[i/8] |= 0x80 >> (i%8);
-		}
-	}
-
 	return 0;
 }
 
@@ -224,13 +263,14 @@ static char n64Probe(void)
 	 */
 
 	n64_rumble_state = RSTATE_UNAVAILABLE;
+	caps_countdown = 0;
 
 	for (i=0; i<15; i++)
 	{
 		_delay_ms(30);
 
 		tmp = N64_GET_CAPABILITIES;
-		count = gcn64_transaction(&tmp, 1);
+		count = gcn64_transactionExpect(&tmp, 1, N64_CAPS_REPLY_LENGTH);
 
 		if (count == N64_CAPS_REPLY_LENGTH) {
 			return 1;
@@ -254,6 +294,9 @@ static void n64getReport(gamepad_data *dst)
 
 static void n64SetVibration(int value)
 {
+	// Applied once the pak is initialised
+	n64_rumble_wanted = value != 0;
+
 	if (n64_rumble_state == RSTATE_UNAVAILABLE ||
 			n64_rumble_state == RSTATE_INIT)
 	{
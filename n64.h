@@ -2,3 +2,17 @@
 
 Gamepad *n64GetGamepad(void);
 
+/* Call right after gcn64_detectController() has found a N64 controller,
+ * while gcn64_workbuf still holds its reply. The reply to the detection
+ * command (N64_GET_CAPABILITIES) gives the pak state, so the first
+ * update does not need to ask again. */
+void n64UseDetectionReply(void);
+
+/* Rumble pak writes (init, motor on or off) are not done by update(), so
+ * they never delay the controller read. They are sent by
+ * n64UpdateRumble(), to be called when there is time for the longest one
+ * (N64_RUMBLE_WRITE_US), while n64RumblePending() is non-zero. */
+#define N64_RUMBLE_WRITE_US		1300
+char n64RumblePending(void);
+void n64UpdateRumble(void);
+
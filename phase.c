@@ -0,0 +1,187 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "timebase.h"
+#include "phase.h"
+
+/* Poll phase tracking
+ *
+ *              |<---- D --->|
+ *         _____  __    __    __________________________  __    __    ____
+ * I2C:         ||  ||||  ||||                          ||  ||||  ||||
+ *              ^   ^                        ^          ^
+ *              |   poll event   update start|          next burst
+ *              |<-- L -->|                  |<-- U --->|<-- M -->|
+ *              |<------------------- B ------------------>|
+ *
+ * B = Period between two reads of the report (5ms, but not guaranteed)
+ * D = Duration of an I2C burst. Varies between menu and in-game.
+ * L = Lead, from the first I2C access of a burst to the report read
+ * U = Time taken by the controller read (measured)
+ * M = PHASE_MARGIN_US
+ *
+ * The next burst is expected at (burst start + B). The controller
+ * read is started so that it completes M before that.
+ */
+
+/* I2C accesses separated by more than this belong to different bursts */
+#define QUIET_TICKS			TIMEBASE_US_TO_TICKS(1000)
+
+/* What was used before the period was known (the former fixed "delay A") */
+#define FALLBACK_TICKS		TIMEBASE_US_TO_TICKS(2350)
+
+#define MARGIN_TICKS		TIMEBASE_US_TO_TICKS(PHASE_MARGIN_US)
+
+/* Plausible poll periods. Anything outside is a pause from the host. */
+#define MIN_PERIOD_TICKS	TIMEBASE_US_TO_TICKS(2000)
+#define MAX_PERIOD_TICKS	TIMEBASE_US_TO_TICKS(20000)
+
+/* Consecutive off-period polls needed to adopt a new rhythm */
+#define RELOCK_COUNT		3
+
+static volatile unsigned int burst_start;
+static volatile unsigned int last_activity;
+static volatile unsigned int last_poll;
+static volatile unsigned int period;
+static volatile unsigned char outliers;
+
+static unsigned int update_cost;
+static unsigned int optional_cost;
+
+void phase_i2cStart(void)
+{
+	unsigned int now = TCNT1;
+
+	if ((now - last_activity) > QUIET_TICKS) {
+		burst_start = now;
+	}
+	last_activity = now;
+}
+
+void phase_i2cEnd(void)
+{
+	last_activity = TCNT1;
+}
+
+void phase_pollEvent(void)
+{
+	unsigned int now = TCNT1;
+	unsigned int measured = now - last_poll;
+	int diff;
+
+	last_poll = now;
+
+#ifndef PHASE_TRACKING
+	// Timer1 stops between polls (EXT_STANDBY): measured is meaningless
+	return;
+#endif
+
+	if (measured < MIN_PERIOD_TICKS || measured > MAX_PERIOD_TICKS) {
+		return;
+	}
+
+	if (!period) {
+		period = measured;
+		return;
+	}
+
+	diff = measured - period;
+	if (diff > (int)(period >> 3) || diff < -(int)(period >> 3)) {
+		// The host may have changed its polling rhythm (menu vs in-game). Follow
+		// it once confirmed, but don't let a single late poll disturb the lock.
+		outliers++;
+		if (outliers >= RELOCK_COUNT) {
+			period = measured;
+			outliers = 0;
+		}
+		return;
+	}
+
+	outliers = 0;
+	period += diff / 4;
+}
+
+char phase_isLocked(void)
+{
+	return period != 0;
+}
+
+unsigned int phase_getUpdateTime(void)
+{
+	unsigned char sreg;
+	unsigned int start, p, now;
+
+	sreg = SREG;
+	cli();
+	p = period;
+	if (p) {
+		start = burst_start + p - MARGIN_TICKS - update_cost;
+	} else {
+		start = last_poll + FALLBACK_TICKS;
+	}
+	SREG = sreg;
+
+	now = timebase_now();
+
+	// Already late, or so far ahead that something is off: Go now.
+	if ((int)(start - now) < 0 || (start - now) > MAX_PERIOD_TICKS) {
+		return now;
+	}
+
+	return start;
+}
+
+char phase_hasTime(unsigned int ticks)
+{
+	unsigned char sreg;
+	unsigned int deadline, p;
+
+	sreg = SREG;
+	cli();
+	p = period;
+	deadline = burst_start + p - MARGIN_TICKS;
+	SREG = sreg;
+
+	if (!p) {
+		return 1;
+	}
+
+	return (int)(deadline - (timebase_now() + ticks)) >= 0;
+}
+
+void phase_addOptionalCost(unsigned int ticks)
+{
+	optional_cost += ticks;
+}
+
+void phase_setUpdateCost(unsigned int ticks)
+{
+	if (ticks > optional_cost) {
+		ticks -= optional_cost;
+	}
+	optional_cost = 0;
+
+	// Follow increases immediately and slowly forget them
+	// so a controller change is followed.
+	if (ticks > update_cost) {
+		update_cost = ticks;
+	} else {
+		update_cost -= (update_cost - ticks) >> 4;
+	}
+}
+
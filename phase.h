@@ -0,0 +1,39 @@
+#ifndef _phase_h__
+#define _phase_h__
+
+/* Tracking the poll period needs Timer1 running between polls, so the
+ * CPU can only idle sleep while waiting for them. It is only needed for
+ * N64/GC reads, which must not overlap the I2C traffic. Other builds
+ * read the controller a fixed time after the poll (as the former delay
+ * A) and can wait for polls in EXT_STANDBY. */
+#if defined(WITH_N64) || defined(WITH_GAMECUBE)
+#define PHASE_TRACKING
+#endif
+
+/* Time to leave between the end of the controller read and the
+ * predicted beginning of the next I2C burst from the wiimote. */
+#ifndef PHASE_MARGIN_US
+#define PHASE_MARGIN_US		250
+#endif
+
+/* Called from the TWI interrupt */
+void phase_i2cStart(void);
+void phase_i2cEnd(void);
+void phase_pollEvent(void);
+
+/* Timestamp (see timebase.h) at which the controller read should begin */
+unsigned int phase_getUpdateTime(void);
+/* Report how long the controller read took */
+void phase_setUpdateCost(unsigned int ticks);
+/* Non-zero if work lasting 'ticks' would still end before the margin
+ * ahead of the next burst. Always true until the period is known. */
+char phase_hasTime(unsigned int ticks);
+/* Time spent on optional work (retries) during the current read. It is
+ * left out of the next phase_setUpdateCost() so the read does not get
+ * scheduled earlier because of it. */
+void phase_addOptionalCost(unsigned int ticks);
+
+char phase_isLocked(void);
+
+#endif // _phase_h__
+
@@ -0,0 +1,222 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "timebase.h"
+#include "wiimote.h"
+#include "profile.h"
+
+#ifdef WITH_PROFILER
+
+#define TICKS_PER_SECOND	(F_CPU / TIMEBASE_PRESCALER)
+
+struct prof_data prof_data;
+
+static volatile unsigned int poll_time;
+static volatile unsigned int polls;
+
+static unsigned int rumble_request;
+static char rumble_waiting;
+
+static unsigned int window_mark;
+static unsigned long window_ticks;
+static unsigned int frames;
+
+static void prof_clear(void)
+{
+	unsigned char i;
+
+	memset(&prof_data, 0, sizeof(prof_data));
+	for (i=0; i<PROF_NUM_STAGES; i++) {
+		prof_data.stages[i].min = 0xffff;
+	}
+}
+
+void prof_init(void)
+{
+	prof_clear();
+	window_mark = timebase_now();
+}
+
+void prof_pollEvent(void)
+{
+	poll_time = TCNT1;
+	polls++;
+}
+
+unsigned int prof_wake(void)
+{
+	unsigned char sreg;
+	unsigned int t;
+
+	sreg = SREG;
+	cli();
+	t = poll_time;
+	SREG = sreg;
+
+	return prof_stage(PROF_STAGE_WAKE, t);
+}
+
+/* Record a duration (in ticks) for a stage */
+void prof_record(unsigned char stage, unsigned int t)
+{
+	struct prof_stage *s = &prof_data.stages[stage];
+
+	if (t < s->min)
+		s->min = t;
+	if (t > s->max)
+		s->max = t;
+	s->last = t;
+	s->sum += t;
+	s->count++;
+}
+
+/* Record the time elapsed since start for a stage. Returns the current
+ * time, so the next stage can be measured from there. */
+unsigned int prof_stage(unsigned char stage, unsigned int start)
+{
+	unsigned int now = timebase_now();
+
+	prof_record(stage, now - start);
+
+	return now;
+}
+
+/* The rumble latency stage is measured from the time the register was
+ * written (from wm_getRumble) to the first command sent after that. */
+void prof_rumbleRequest(unsigned int when)
+{
+	rumble_request = when;
+	rumble_waiting = 1;
+}
+
+void prof_rumbleSent(void)
+{
+	if (rumble_waiting) {
+		rumble_waiting = 0;
+		prof_stage(PROF_STAGE_RUMBLE, rumble_request);
+	}
+}
+
+void prof_count(unsigned char counter)
+{
+	// Saturate instead of wrapping
+	if (prof_data.counters[counter] != 0xffff)
+		prof_data.counters[counter]++;
+}
+
+static void put16(unsigned char *dst, unsigned int v)
+{
+	dst[0] = v >> 8;
+	dst[1] = v;
+}
+
+static void prof_endWindow(void)
+{
+	unsigned char sreg;
+	unsigned long asleep;
+	unsigned char i;
+
+	sreg = SREG;
+	cli();
+	prof_data.polls_per_sec = polls;
+	polls = 0;
+	SREG = sreg;
+
+	prof_data.frames_per_sec = frames;
+	frames = 0;
+
+	asleep = timebase_getAsleepTicks();
+	if (asleep > window_ticks)
+		asleep = window_ticks;
+	prof_data.awake_pct = 100 - (asleep * 100) / window_ticks;
+
+	for (i=0; i<PROF_NUM_STAGES; i++) {
+		struct prof_stage *s = &prof_data.stages[i];
+
+		s->avg = s->count ? s->sum / s->count : 0;
+		s->sum = 0;
+		s->count = 0;
+	}
+
+	window_ticks = 0;
+}
+
+/* Called once per frame. Updates the rates every second and copies
+ * the page selected by the master to the register window.
+ *
+ * Frames are assumed to be less than one timebase wrap (43ms at 12MHz)
+ * apart. When the wiimote stops polling, the next rates will be off. */
+void prof_frame(void)
+{
+	unsigned char page[PROF_PAGE_SIZE];
+	unsigned char sel;
+	unsigned int now;
+	unsigned char i;
+
+	now = timebase_now();
+	window_ticks += (unsigned int)(now - window_mark);
+	window_mark = now;
+	frames++;
+
+	if (window_ticks >= TICKS_PER_SECOND) {
+		prof_endWindow();
+	}
+
+	sel = wm_getReg(PROF_REG_PAGE);
+	if (sel & 0x80) {
+		prof_clear();
+		sel &= 0x7f;
+		wm_setRegs(PROF_REG_PAGE, &sel, 1);
+	}
+
+	memset(page, 0, sizeof(page));
+
+	switch (sel)
+	{
+		case PROF_PAGE_RATES:
+			put16(page + 0, prof_data.polls_per_sec);
+			put16(page + 2, prof_data.frames_per_sec);
+			page[4] = prof_data.awake_pct;
+			page[5] = TIMEBASE_US_TO_TICKS(100);
+			page[6] = PROF_PAGE_STAGES + PROF_NUM_STAGES;
+			break;
+
+		case PROF_PAGE_COUNTERS:
+			for (i=0; i<PROF_NUM_COUNTERS; i++) {
+				put16(page + i * 2, prof_data.counters[i]);
+			}
+			break;
+
+		default:
+			if (sel >= PROF_PAGE_STAGES && sel < PROF_PAGE_STAGES + PROF_NUM_STAGES) {
+				struct prof_stage *s = &prof_data.stages[sel - PROF_PAGE_STAGES];
+
+				put16(page + 0, s->min);
+				put16(page + 2, s->max);
+				put16(page + 4, s->avg);
+				put16(page + 6, s->last);
+			}
+			break;
+	}
+
+	wm_setRegs(PROF_REG_DATA, page, PROF_PAGE_SIZE);
+}
+
+#endif // WITH_PROFILER
+
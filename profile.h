@@ -0,0 +1,118 @@
+#ifndef _profile_h__
+#define _profile_h__
+
+/* Main loop profiler and health counters. Only built with -DWITH_PROFILER.
+ *
+ * Everything is readable from the wiimote side (or any I2C master talking
+ * to address 0x52) through a paged window in the virtual register space:
+ *
+ *  0xE0       Page select. Written by the master. Setting bit 7
+ *             clears all statistics (the bit is then cleared).
+ *  0xE1-0xEF  Contents of the selected page, refreshed once per frame.
+ *
+ * 16 bit values are big endian. Durations are in timebase ticks
+ * (F_CPU/8, see timebase.h).
+ *
+ * Page 0 : Rates, over the last second
+ *   0-1  I2C polls per second
+ *   2-3  Frames (main loop iterations) per second
+ *   4    Percentage of time awake
+ *   5    Timebase ticks per 100us
+ *   6    Number of pages
+ *
+ * Page 1 : Counters, since the last clear
+ *   0-1  Joybus timeouts (no answer from the controller)
+ *   2-3  Controller lost (error count exceeded)
+ *   4-5  N64/GC detection attempts
+ *   6-7  Joybus replies rejected (wrong length or fixed bits)
+ *   8-9  Joybus retries (see gcn64_transactionChecked)
+ *
+ * Pages 2 and up : One per stage, in PROF_STAGE_* order
+ *   0-1  Minimum (since the last clear)
+ *   2-3  Maximum (since the last clear)
+ *   4-5  Average over the last second
+ *   6-7  Most recent
+ */
+
+#define PROF_REG_PAGE		0xE0
+#define PROF_REG_DATA		0xE1
+#define PROF_PAGE_SIZE		15
+
+#define PROF_PAGE_RATES		0
+#define PROF_PAGE_COUNTERS	1
+#define PROF_PAGE_STAGES	2
+
+#define PROF_STAGE_WAKE		0	// From the poll event to the main loop running
+#define PROF_STAGE_UPDATE	1	// Controller read (gamepad update and getReport)
+#define PROF_STAGE_MAP		2	// dataToClassic
+#define PROF_STAGE_PACK		3	// pack_classic_data
+#define PROF_STAGE_PUBLISH	4	// wm_publishReport / wm_newaction
+#define PROF_STAGE_RUMBLE	5	// From a rumble register change to the joybus command carrying it
+#define PROF_STAGE_SAMPLE	6	// Oversampling (WITH_OVERSAMPLE), total per frame
+#define PROF_NUM_STAGES		7
+
+#define PROF_CNT_JOYBUS_TIMEOUT	0
+#define PROF_CNT_CONTROLLER_LOST	1
+#define PROF_CNT_DETECT			2
+#define PROF_CNT_JOYBUS_REJECT	3
+#define PROF_CNT_JOYBUS_RETRY	4
+#define PROF_NUM_COUNTERS		5
+
+#ifdef WITH_PROFILER
+
+struct prof_stage {
+	unsigned int min, max, last;
+	unsigned int count;
+	unsigned long sum;
+	unsigned int avg;
+};
+
+struct prof_data {
+	struct prof_stage stages[PROF_NUM_STAGES];
+	unsigned int counters[PROF_NUM_COUNTERS];
+	unsigned int polls_per_sec;
+	unsigned int frames_per_sec;
+	unsigned char awake_pct;
+};
+
+/* Global so it can be found by symbol name from a simulator */
+extern struct prof_data prof_data;
+
+void prof_init(void);
+void prof_pollEvent(void); // from the TWI interrupt
+unsigned int prof_wake(void);
+unsigned int prof_stage(unsigned char stage, unsigned int start);
+void prof_record(unsigned char stage, unsigned int ticks);
+void prof_count(unsigned char counter);
+void prof_frame(void);
+void prof_rumbleRequest(unsigned int when);
+void prof_rumbleSent(void);
+
+#define PROF_DECLARE(t)		unsigned int t
+#define PROF_MARK(t)		t = timebase_now()
+#define PROF_WAKE(t)		t = prof_wake()
+#define PROF_STAGE(s, t)	t = prof_stage(s, t)
+#define PROF_TICKS(s, ticks)	prof_record(s, ticks)
+#define PROF_COUNT(c)		prof_count(c)
+#define PROF_RUMBLE_REQUEST(t)	prof_rumbleRequest(t)
+#define PROF_RUMBLE_SENT()	prof_rumbleSent()
+
+#else
+
+#define prof_init()			do { } while(0)
+#define prof_pollEvent()	do { } while(0)
+#define prof_frame()		do { } while(0)
+
+#define PROF_DECLARE(t)
+#define PROF_MARK(t)		do { } while(0)
+#define PROF_WAKE(t)		do { } while(0)
+#define PROF_STAGE(s, t)	do { } while(0)
+#define PROF_TICKS(s, ticks)	do { } while(0)
+#define PROF_COUNT(c)		do { } while(0)
+#define PROF_RUMBLE_REQUEST(t)	do { } while(0)
+#define PROF_RUMBLE_SENT()	do { } while(0)
+
+#endif
+
+#endif // _profile_h__
+
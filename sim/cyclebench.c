@@ -0,0 +1,310 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fw.h"
+
+/* Exact cycle counts for the hot paths of the firmware, obtained by
+ * calling them directly in the simulated MCU. Every case has a budget
+ * (budgets.txt). Going over it, or a case without a budget, is a
+ * failure. So is checking against budgets that were not measured (not
+ * written by -u). */
+
+#define MAX_CYCLES		200000
+
+// ATmega168 TWI registers (data space addresses)
+#define TWSR_ADDR		0xb9
+#define TWDR_ADDR		0xbb
+
+// From util/twi.h
+#define TW_SR_SLA_ACK	0x60
+#define TW_SR_DATA_ACK	0x80
+#define TW_SR_STOP		0xA0
+#define TW_ST_SLA_ACK	0xA8
+#define TW_ST_DATA_ACK	0xB8
+
+// From gamepads.h, analog.h and classic.h
+#define PAD_TYPE_N64		4
+#define PAD_TYPE_GAMECUBE	5
+#define ANALOG_STYLE_N64	1
+#define ANALOG_STYLE_GC		2
+
+#define NOT_AVAILABLE	-2
+
+struct bench_case {
+	const char *name;
+	long (*run)(avr_t *avr, const struct bench_case *c);
+	int param;
+	int param2;
+};
+
+static long callByName(avr_t *avr, const char *name, int nargs, const uint16_t *args)
+{
+	uint32_t addr = fw_sym(name);
+
+	if (addr == FW_NO_SYMBOL)
+		return NOT_AVAILABLE;
+
+	return fw_call(avr, addr, nargs, args, MAX_CYCLES);
+}
+
+/* One invocation of ISR(TWI_vect) with TWSR set to param. param2
+ * enables encryption. The 7 cycles of interrupt response and vector
+ * jump are not included. */
+static long benchTwi(avr_t *avr, const struct bench_case *c)
+{
+	uint32_t pollfunc = fw_sym("pollfunc");
+	uint16_t reg_addr = 0x10;
+
+	if (pollfunc == FW_NO_SYMBOL) {
+		fprintf(stderr, "pollfunc not found\n");
+		return -1;
+	}
+	// Normally done by wm_init(). Function pointers are word addresses.
+	fw_poke16(avr, "wm_sample_event", pollfunc / 2);
+
+	switch (c->param)
+	{
+		case TW_ST_SLA_ACK: reg_addr = 0x00; break; // Report read: Poll event
+		case TW_ST_DATA_ACK: reg_addr = 0x02; break;
+		case TW_SR_STOP: reg_addr = 0xFF; break; // Mode register write
+	}
+
+	fw_poke8(avr, "g_enc_on", c->param2);
+	fw_poke8(avr, "twi_first_addr_flag", 1);
+	fw_poke16(avr, "twi_reg_addr", reg_addr);
+	fw_poke8(avr, "twi_rw_len", 1);
+	fw_poke8(avr, "wm_tx_bank", 0);
+	avr->data[TWSR_ADDR] = c->param;
+	avr->data[TWDR_ADDR] = 0x01;
+
+	return callByName(avr, "__vector_24", 0, NULL);
+}
+
+static long benchGcDecode(avr_t *avr, const struct bench_case *c)
+{
+	static const uint8_t reply[8] = { 0x01, 0x80, 0x85, 0x7a, 0x80, 0x80, 0x10, 0x20 };
+
+	fw_poke(avr, fw_sym("gcn64_workbuf"), reply, sizeof(reply));
+
+	return callByName(avr, "gc_decodeAnswer", 0, NULL);
+}
+
+static long benchFunction(avr_t *avr, const struct bench_case *c)
+{
+	return callByName(avr, c->name, 0, NULL);
+}
+
+/* dataToClassic() followed by pack_classic_data(), param is the classic
+ * mode and param2 the controller type. */
+static long benchMapPack(avr_t *avr, const struct bench_case *c)
+{
+	uint16_t src = fw_scratch();
+	uint16_t classic = src + 32;
+	uint16_t packed = src + 64;
+	uint8_t data[32];
+	uint16_t args[4];
+	long map, pack;
+
+	memset(data, 0, sizeof(data));
+	data[0] = c->param2;
+	if (c->param2 == PAD_TYPE_GAMECUBE) {
+		// x, y, cx, cy, lt, rt, buttons (A, Start, dpad up), raw
+		static const uint8_t gc[] = { 50, 0xd0, 20, 0xf0, 0x40, 0x10, 0x11, 0x08, 0x18,0x90,0xb2,0x50,0x94,0x70,0x40,0x10 };
+		memcpy(data + 1, gc, sizeof(gc));
+	} else {
+		// x, y, buttons (A, Z, C up), raw
+		static const uint8_t n64[] = { 50, 0xd0, 0xa0, 0x08, 0xa0,0x08,0x32,0xd0 };
+		memcpy(data + 1, n64, sizeof(n64));
+	}
+	fw_poke(avr, src, data, sizeof(data));
+
+	args[0] = src;
+	args[1] = classic;
+	args[2] = 0; // first_read
+	map = callByName(avr, "dataToClassic", 3, args);
+	if (map < 0)
+		return map;
+
+	args[0] = classic;
+	args[1] = packed;
+	args[2] = c->param2 == PAD_TYPE_GAMECUBE ? ANALOG_STYLE_GC : ANALOG_STYLE_N64;
+	args[3] = c->param;
+	pack = callByName(avr, "pack_classic_data", 4, args);
+	if (pack < 0)
+		return pack;
+
+	return map + pack;
+}
+
+static const struct bench_case cases[] = {
+	{ "twi_sr_sla",			benchTwi, TW_SR_SLA_ACK, 0 },
+	{ "twi_sr_data",		benchTwi, TW_SR_DATA_ACK, 0 },
+	{ "twi_sr_data_enc",	benchTwi, TW_SR_DATA_ACK, 1 },
+	{ "twi_sr_stop",		benchTwi, TW_SR_STOP, 0 },
+	{ "twi_st_sla_poll",	benchTwi, TW_ST_SLA_ACK, 0 },
+	{ "twi_st_sla_poll_enc",benchTwi, TW_ST_SLA_ACK, 1 },
+	{ "twi_st_data",		benchTwi, TW_ST_DATA_ACK, 0 },
+	{ "twi_st_data_enc",	benchTwi, TW_ST_DATA_ACK, 1 },
+	{ "gc_decodeAnswer",	benchGcDecode },
+	{ "snesUpdate",			benchFunction },
+	{ "db9Update",			benchFunction },
+	{ "map_pack_gc_mode1",	benchMapPack, 0, PAD_TYPE_GAMECUBE },
+	{ "map_pack_gc_mode2",	benchMapPack, 1, PAD_TYPE_GAMECUBE },
+	{ "map_pack_gc_mode3",	benchMapPack, 2, PAD_TYPE_GAMECUBE },
+	{ "map_pack_n64_mode1",	benchMapPack, 0, PAD_TYPE_N64 },
+	{ "map_pack_n64_mode2",	benchMapPack, 1, PAD_TYPE_N64 },
+	{ "map_pack_n64_mode3",	benchMapPack, 2, PAD_TYPE_N64 },
+};
+#define N_CASES	(sizeof(cases) / sizeof(cases[0]))
+
+static long getBudget(const char *budget_file, const char *name)
+{
+	char line[128], n[64];
+	long cycles;
+	FILE *fptr;
+
+	fptr = fopen(budget_file, "r");
+	if (!fptr)
+		return -1;
+
+	while (fgets(line, sizeof(line), fptr)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%63s %ld", n, &cycles) != 2)
+			continue;
+		if (!strcmp(n, name)) {
+			fclose(fptr);
+			return cycles;
+		}
+	}
+
+	fclose(fptr);
+	return -1;
+}
+
+/* Budgets written by -u start with MEASURED_TAG. Others are estimates. */
+#define MEASURED_TAG	"# Measured"
+
+static int budgetsMeasured(const char *budget_file)
+{
+	char line[128];
+	FILE *fptr;
+	int measured;
+
+	fptr = fopen(budget_file, "r");
+	if (!fptr)
+		return 0;
+
+	measured = fgets(line, sizeof(line), fptr) &&
+				!strncmp(line, MEASURED_TAG, strlen(MEASURED_TAG));
+	fclose(fptr);
+
+	return measured;
+}
+
+static void usage(void)
+{
+	printf("Usage: ./cyclebench [options] firmware.elf\n");
+	printf("\n");
+	printf(" -b file    Budgets (default: budgets.txt)\n");
+	printf(" -u         Output new budgets (measured + 10%%) instead of checking\n");
+	printf(" -m mcu     MCU (default: atmega168)\n");
+	printf(" -f freq    Frequency (default: 12000000)\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *budget_file = "budgets.txt";
+	const char *mmcu = "atmega168";
+	uint32_t freq = 12000000;
+	int update = 0, failed = 0, estimates = 0;
+	unsigned int i;
+	avr_t *avr;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:um:f:h")) != -1) {
+		switch (opt)
+		{
+			case 'b': budget_file = optarg; break;
+			case 'u': update = 1; break;
+			case 'm': mmcu = optarg; break;
+			case 'f': freq = strtoul(optarg, NULL, 0); break;
+			case 'h': usage(); return 0;
+			default: usage(); return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+		return 1;
+	}
+
+	avr = fw_load(argv[optind], mmcu, freq);
+	if (!avr)
+		return 1;
+
+	if (update) {
+		printf("%s with cyclebench -u (measured + 10%%)\n", MEASURED_TAG);
+		printf("# case                  max cycles (%s @ %u Hz)\n", mmcu, freq);
+	} else {
+		estimates = !budgetsMeasured(budget_file);
+		printf("%-24s %8s %8s\n", "case", "cycles", "budget");
+	}
+
+	for (i=0; i<N_CASES; i++) {
+		const struct bench_case *c = &cases[i];
+		long cycles, budget;
+
+		cycles = c->run(avr, c);
+
+		if (update) {
+			if (cycles >= 0)
+				printf("%-24s %ld\n", c->name, (cycles * 11 / 10 + 9) / 10 * 10);
+			continue;
+		}
+
+		budget = getBudget(budget_file, c->name);
+
+		if (cycles == NOT_AVAILABLE) {
+			// Inlined or not linked in this build
+			printf("%-24s %8s %8ld\n", c->name, "n/a", budget);
+		} else if (cycles < 0) {
+			printf("%-24s %8s %8ld  FAIL (did not return)\n", c->name, "-", budget);
+			failed++;
+		} else if (budget < 0) {
+			printf("%-24s %8ld %8s  FAIL (no budget)\n", c->name, cycles, "-");
+			failed++;
+		} else if (cycles > budget) {
+			printf("%-24s %8ld %8ld  FAIL (over budget)\n", c->name, cycles, budget);
+			failed++;
+		} else {
+			printf("%-24s %8ld %8ld\n", c->name, cycles, budget);
+		}
+	}
+
+	// Only measured budgets make a gate
+	if (estimates) {
+		printf("\nFAIL: %s holds estimates, not measurements. Run 'make budgets'.\n", budget_file);
+		failed++;
+	}
+
+	return failed ? 1 : 0;
+}
+
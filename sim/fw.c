@@ -0,0 +1,204 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_core.h>
+#include "fw.h"
+
+#define MAX_SYMBOLS	1024
+
+struct symbol {
+	char name[64];
+	uint32_t addr;
+};
+
+static struct symbol symbols[MAX_SYMBOLS];
+static int n_symbols;
+static uint16_t ramend;
+
+static int loadSymbols(const char *elf_file)
+{
+	char cmd[512], line[256], name[64], type;
+	unsigned long addr;
+	FILE *p;
+
+	snprintf(cmd, sizeof(cmd), "avr-nm %s", elf_file);
+	p = popen(cmd, "r");
+	if (!p) {
+		perror("avr-nm");
+		return -1;
+	}
+
+	n_symbols = 0;
+	while (fgets(line, sizeof(line), p) && n_symbols < MAX_SYMBOLS) {
+		if (sscanf(line, "%lx %c %63s", &addr, &type, name) != 3)
+			continue;
+
+		// Variables are at 0x800000 and up in the elf
+		if (addr >= 0x800000)
+			addr &= 0xffff;
+
+		strcpy(symbols[n_symbols].name, name);
+		symbols[n_symbols].addr = addr;
+		n_symbols++;
+	}
+
+	return pclose(p) ? -1 : 0;
+}
+
+uint32_t fw_sym(const char *name)
+{
+	int i;
+
+	for (i=0; i<n_symbols; i++) {
+		if (!strcmp(symbols[i].name, name))
+			return symbols[i].addr;
+	}
+
+	return FW_NO_SYMBOL;
+}
+
+uint16_t fw_scratch(void)
+{
+	uint32_t addr = fw_sym("__heap_start");
+
+	if (addr == FW_NO_SYMBOL) {
+		fprintf(stderr, "__heap_start not found\n");
+		exit(1);
+	}
+
+	return addr;
+}
+
+void fw_poke(avr_t *avr, uint32_t addr, const void *data, int len)
+{
+	memcpy(avr->data + addr, data, len);
+}
+
+void fw_peek(avr_t *avr, uint32_t addr, void *data, int len)
+{
+	memcpy(data, avr->data + addr, len);
+}
+
+static uint32_t requireSym(const char *name)
+{
+	uint32_t addr = fw_sym(name);
+
+	if (addr == FW_NO_SYMBOL) {
+		fprintf(stderr, "Symbol %s not found\n", name);
+		exit(1);
+	}
+	return addr;
+}
+
+void fw_poke8(avr_t *avr, const char *name, uint8_t value)
+{
+	avr->data[requireSym(name)] = value;
+}
+
+void fw_poke16(avr_t *avr, const char *name, uint16_t value)
+{
+	uint32_t addr = requireSym(name);
+
+	avr->data[addr] = value;
+	avr->data[addr+1] = value >> 8;
+}
+
+uint16_t fw_retval(avr_t *avr)
+{
+	return avr->data[24] | (avr->data[25] << 8);
+}
+
+long fw_call(avr_t *avr, uint32_t addr, int nargs, const uint16_t *args, long max_cycles)
+{
+	avr_cycle_count_t start;
+	uint16_t sp = ramend;
+	int i, state;
+
+	for (i=0; i<nargs; i++) {
+		avr->data[24 - i*2] = args[i];
+		avr->data[25 - i*2] = args[i] >> 8;
+	}
+
+	// Return address 0. Seeing the PC there means the function returned.
+	avr->data[sp--] = 0;
+	avr->data[sp--] = 0;
+	_avr_sp_set(avr, sp);
+
+	avr->sreg[S_I] = 0;
+	avr->pc = addr;
+	avr->state = cpu_Running;
+
+	start = avr->cycle;
+	while (avr->pc != 0) {
+		state = avr_run(avr);
+		if (state == cpu_Done || state == cpu_Crashed)
+			return -1;
+		if ((long)(avr->cycle - start) > max_cycles)
+			return -1;
+	}
+
+	// An ISR returns with reti, which enables interrupts.
+	avr->sreg[S_I] = 0;
+
+	return avr->cycle - start;
+}
+
+avr_t *fw_load(const char *elf_file, const char *mmcu, uint32_t frequency)
+{
+	elf_firmware_t f;
+	avr_t *avr;
+	uint32_t main_addr;
+	long n;
+
+	memset(&f, 0, sizeof(f));
+	if (elf_read_firmware(elf_file, &f)) {
+		fprintf(stderr, "Could not read %s\n", elf_file);
+		return NULL;
+	}
+	strcpy(f.mmcu, mmcu);
+	f.frequency = frequency;
+
+	if (loadSymbols(elf_file)) {
+		fprintf(stderr, "Could not read symbols from %s\n", elf_file);
+		return NULL;
+	}
+
+	avr = avr_make_mcu_by_name(f.mmcu);
+	if (!avr) {
+		fprintf(stderr, "Unknown MCU %s\n", f.mmcu);
+		return NULL;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &f);
+	ramend = avr->ramend;
+
+	// Let the startup code copy .data and clear .bss
+	main_addr = requireSym("main");
+	for (n=0; avr->pc != main_addr; n++) {
+		if (n > 1000000 || avr_run(avr) == cpu_Crashed) {
+			fprintf(stderr, "main() not reached\n");
+			return NULL;
+		}
+	}
+
+	return avr;
+}
+
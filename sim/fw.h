@@ -0,0 +1,39 @@
+#ifndef _fw_h__
+#define _fw_h__
+
+#include <stdint.h>
+#include <simavr/sim_avr.h>
+
+/* Helpers to run pieces of the real firmware under simavr */
+
+#define FW_NO_SYMBOL	0xffffffff
+
+/* Load the elf, run the C runtime startup code up to main()
+ * and stop there. Returns NULL on error. */
+avr_t *fw_load(const char *elf_file, const char *mmcu, uint32_t frequency);
+
+/* Address of a symbol (from avr-nm). Functions: byte address in flash.
+ * Variables: address in data space. FW_NO_SYMBOL when not found (not
+ * linked, or inlined by the compiler). */
+uint32_t fw_sym(const char *name);
+
+/* Read and write variables in data space */
+void fw_poke(avr_t *avr, uint32_t addr, const void *data, int len);
+void fw_peek(avr_t *avr, uint32_t addr, void *data, int len);
+void fw_poke8(avr_t *avr, const char *name, uint8_t value);
+void fw_poke16(avr_t *avr, const char *name, uint16_t value);
+
+/* First address past the firmware variables, usable as scratch memory */
+uint16_t fw_scratch(void);
+
+/* Call a function following the avr-gcc calling convention (up to 4
+ * 16 bit arguments, in r24, r22, r20 and r18). Runs until it returns
+ * and gives the number of cycles it took, or -1 if it did not return
+ * within max_cycles. Interrupts are kept disabled. */
+long fw_call(avr_t *avr, uint32_t addr, int nargs, const uint16_t *args, long max_cycles);
+
+/* Return value of the last call (r24, r25) */
+uint16_t fw_retval(avr_t *avr);
+
+#endif // _fw_h__
+
@@ -0,0 +1,427 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_time.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_ioport.h>
+#include "gcn64pad.h"
+
+#define DATA_PIN	3
+
+/* Low pulses shorter than this are 1s. Half way between 1us and 3us. */
+#define BIT_THRESHOLD_NS	2000
+
+/* No edge for this long in the middle of a command: The firmware gave up
+ * or sent something unknown. */
+#define SILENCE_NS			10000
+
+#define MIN_PHASE_NS		100
+
+const struct gcn64pad_timing gcn64pad_official = { "official", 1000, 3000, 2000, 2000 };
+const struct gcn64pad_timing gcn64pad_hori = { "hori", 1500, 4500, 3000, 3000 };
+
+static unsigned long rng(gcn64pad_t *pad)
+{
+	pad->rng = pad->rng * 1103515245 + 12345;
+	return (pad->rng >> 16) & 0x7fff;
+}
+
+static avr_cycle_count_t nsToCycles(gcn64pad_t *pad, uint64_t ns)
+{
+	return (ns * pad->avr->frequency + 500000000) / 1000000000;
+}
+
+/* The address checksum covers the 11 high bits of the address. The
+ * table gives the contribution of each bit, indexed by bit number. */
+uint8_t gcn64pad_addrCrc(uint16_t addr)
+{
+	static const uint8_t xor_table[16] = {
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x15, 0x1f, 0x0b,
+		0x16, 0x19, 0x07, 0x0e, 0x1c, 0x0d, 0x1a, 0x01
+	};
+	uint8_t crc = 0;
+	int i;
+
+	for (i=5; i<16; i++) {
+		if (addr & (1 << i))
+			crc ^= xor_table[i];
+	}
+
+	return crc;
+}
+
+/* CRC-8 (polynomial 0x85) over the 32 data bytes, as returned by the
+ * controller after expansion reads and writes. */
+uint8_t gcn64pad_dataCrc(const uint8_t *data)
+{
+	uint8_t crc = 0;
+	int i, bit;
+
+	for (i=0; i<=32; i++) {
+		for (bit=7; bit>=0; bit--) {
+			uint8_t x = (crc & 0x80) ? 0x85 : 0x00;
+
+			crc <<= 1;
+			if (i < 32 && (data[i] & (1 << bit)))
+				crc |= 1;
+			crc ^= x;
+		}
+	}
+
+	return crc;
+}
+
+/* Expected length of a command, from its first byte. 0 if unknown. */
+static int commandLength(gcn64pad_t *pad, uint8_t cmd)
+{
+	if (pad->type == GCN64PAD_N64) {
+		switch (cmd)
+		{
+			case 0x00: // Get capabilities
+			case 0xff: // Reset
+			case 0x01: return 1; // Get status
+			case 0x02: return 3; // Expansion read
+			case 0x03: return 35; // Expansion write
+		}
+	} else {
+		switch (cmd)
+		{
+			case 0x00: // Get id
+			case 0xff: return 1; // Reset
+			case 0x40: return 3; // Get status
+			case 0x41: return 1; // Get origins
+			case 0x42: return 3; // Calibrate
+		}
+	}
+
+	return 0;
+}
+
+static void expansionRead(gcn64pad_t *pad, uint16_t addr, uint8_t *data)
+{
+	memset(data, 0, 32);
+
+	switch (pad->pak)
+	{
+		case GCN64PAD_PAK_MEMORY:
+			if (addr < sizeof(pad->mem))
+				memcpy(data, pad->mem + addr, 32);
+			break;
+
+		case GCN64PAD_PAK_RUMBLE:
+			// Reads 0x80 once 0x80 has been written at 0x8000 (identification)
+			if (addr >= 0x8000 && addr < 0x9000 && pad->pak_probe == 0x80)
+				memset(data, 0x80, 32);
+			break;
+	}
+}
+
+static void expansionWrite(gcn64pad_t *pad, uint16_t addr, const uint8_t *data)
+{
+	switch (pad->pak)
+	{
+		case GCN64PAD_PAK_MEMORY:
+			if (addr < sizeof(pad->mem))
+				memcpy(pad->mem + addr, data, 32);
+			break;
+
+		case GCN64PAD_PAK_RUMBLE:
+			if (addr >= 0x8000 && addr < 0x9000)
+				pad->pak_probe = data[31];
+			if (addr >= 0xc000)
+				pad->rumble = data[31] & 1;
+			break;
+	}
+}
+
+/* Build the reply to the command in pad->cmd. Returns its length in bytes. */
+static int buildReply(gcn64pad_t *pad)
+{
+	uint8_t *r = pad->reply;
+	uint16_t addr;
+	uint8_t crc;
+
+	if (pad->type == GCN64PAD_N64) {
+		switch (pad->cmd[0])
+		{
+			case 0x00:
+			case 0xff:
+				r[0] = 0x05;
+				r[1] = 0x00;
+				r[2] = pad->pak ? 0x01 : (pad->pak_removed ? 0x02 : 0x00);
+				pad->pak_removed = 0;
+				return 3;
+
+			case 0x01:
+				memcpy(r, pad->status, 4);
+				return 4;
+
+			case 0x02:
+			case 0x03:
+				addr = (pad->cmd[1] << 8) | pad->cmd[2];
+				if ((addr & 0x1f) != gcn64pad_addrCrc(addr)) {
+					pad->addr_crc_errors++;
+				}
+				addr &= 0xffe0;
+
+				if (pad->cmd[0] == 0x02) {
+					expansionRead(pad, addr, r);
+					crc = gcn64pad_dataCrc(r);
+				} else {
+					expansionWrite(pad, addr, pad->cmd + 3);
+					crc = gcn64pad_dataCrc(pad->cmd + 3);
+				}
+				// Without a pak, the checksum is inverted
+				if (!pad->pak)
+					crc ^= 0xff;
+
+				if (pad->cmd[0] == 0x02) {
+					r[32] = crc;
+					return 33;
+				}
+				r[0] = crc;
+				return 1;
+		}
+	} else {
+		switch (pad->cmd[0])
+		{
+			case 0x00:
+			case 0xff:
+				memcpy(r, pad->id, 3);
+				return 3;
+
+			case 0x40:
+				pad->rumble = pad->cmd[2] & 1;
+				memcpy(r, pad->status, 8);
+				return 8;
+
+			case 0x41:
+			case 0x42:
+				memcpy(r, pad->origins, 10);
+				return 10;
+		}
+	}
+
+	return 0;
+}
+
+static int jitter(gcn64pad_t *pad, uint32_t ns)
+{
+	long j;
+
+	if (!pad->jitter_ns)
+		return ns;
+
+	j = (long)(rng(pad) % (pad->jitter_ns * 2 + 1)) - (long)pad->jitter_ns;
+	if ((long)ns + j < MIN_PHASE_NS)
+		return MIN_PHASE_NS;
+
+	return ns + j;
+}
+
+static void addEdge(gcn64pad_t *pad, avr_cycle_count_t start, uint64_t ns, uint8_t level)
+{
+	struct gcn64pad_edge *e = &pad->edges[pad->n_edges++];
+
+	e->when = start + nsToCycles(pad, ns);
+	e->level = level;
+}
+
+static avr_cycle_count_t edgeTimer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	gcn64pad_t *pad = param;
+	struct gcn64pad_edge *e = &pad->edges[pad->next_edge++];
+
+	avr_raise_irq(pad->data_irq, e->level);
+	pad->last_edge = avr->cycle;
+
+	if (pad->next_edge >= pad->n_edges) {
+		pad->replies++;
+		return 0;
+	}
+
+	return pad->edges[pad->next_edge].when;
+}
+
+/* Schedule the edges of the reply in pad->reply. Timings are computed
+ * from the start of the reply (not edge to edge) so rounding to cycles
+ * does not accumulate. */
+static void sendReply(gcn64pad_t *pad, int len)
+{
+	avr_cycle_count_t start = pad->avr->cycle;
+	uint64_t t = pad->timing.turnaround_ns;
+	int i, bit;
+
+	pad->reply_bits = len * 8;
+	pad->n_edges = 0;
+	pad->next_edge = 0;
+
+	for (i=0; i<pad->reply_bits; i++) {
+		bit = pad->reply[i/8] & (0x80 >> (i%8));
+
+		if (pad->bit_error_rate > 0 && rng(pad) < pad->bit_error_rate * 32768) {
+			bit = !bit;
+			pad->flipped_bits++;
+		}
+
+		addEdge(pad, start, t, 0);
+		t += jitter(pad, bit ? pad->timing.short_ns : pad->timing.long_ns);
+		addEdge(pad, start, t, 1);
+		t += jitter(pad, bit ? pad->timing.long_ns : pad->timing.short_ns);
+	}
+
+	addEdge(pad, start, t, 0);
+	t += jitter(pad, pad->timing.stop_ns);
+	addEdge(pad, start, t, 1);
+
+	avr_cycle_timer_register(pad->avr, pad->edges[0].when - start, edgeTimer, pad);
+}
+
+static avr_cycle_count_t silenceTimer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	gcn64pad_t *pad = param;
+
+	// A command is 8 bits per byte plus the stop bit
+	if ((pad->cmd_bits % 8) == 1) {
+		pad->commands++;
+		pad->unknown++;
+	} else {
+		pad->framing_errors++;
+	}
+	pad->receiving = 0;
+
+	return 0;
+}
+
+static void lineReleased(gcn64pad_t *pad)
+{
+	avr_cycle_count_t low = pad->avr->cycle - pad->fall;
+	int len, bit;
+
+	pad->last_edge = pad->avr->cycle;
+	bit = low < nsToCycles(pad, BIT_THRESHOLD_NS);
+
+	if (pad->cmd_bits < GCN64PAD_MAX_BYTES * 8) {
+		if (bit)
+			pad->cmd[pad->cmd_bits / 8] |= 0x80 >> (pad->cmd_bits % 8);
+		pad->cmd_bits++;
+	}
+
+	// Complete once the stop bit (counted as a 1 above) follows the last byte
+	if (pad->cmd_bits > 8) {
+		len = commandLength(pad, pad->cmd[0]);
+		if (len && pad->cmd_bits == len * 8 + 1) {
+			avr_cycle_timer_cancel(pad->avr, silenceTimer, pad);
+			pad->receiving = 0;
+			pad->commands++;
+
+			len = buildReply(pad);
+			if (len)
+				sendReply(pad, len);
+			return;
+		}
+	}
+
+	avr_cycle_timer_register(pad->avr, nsToCycles(pad, SILENCE_NS), silenceTimer, pad);
+}
+
+/* The firmware writes DDRC. A set bit 3 pulls the line low. */
+static void directionNotify(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	gcn64pad_t *pad = param;
+	int low = (value >> DATA_PIN) & 1;
+
+	if (!pad->connected)
+		return;
+	if (low == pad->line_low)
+		return;
+	pad->line_low = low;
+
+	if (pad->next_edge < pad->n_edges) {
+		// The firmware is driving the line while we reply
+		pad->collisions++;
+		return;
+	}
+
+	if (low) {
+		if (!pad->receiving) {
+			pad->receiving = 1;
+			pad->cmd_bits = 0;
+			memset(pad->cmd, 0, sizeof(pad->cmd));
+			pad->first_edge = pad->avr->cycle;
+		}
+		pad->fall = pad->avr->cycle;
+		avr_cycle_timer_cancel(pad->avr, silenceTimer, pad);
+	} else {
+		// The pull-up brings the line back high
+		avr_raise_irq(pad->data_irq, 1);
+		if (pad->receiving)
+			lineReleased(pad);
+	}
+}
+
+void gcn64pad_reset(gcn64pad_t *pad)
+{
+	avr_cycle_timer_cancel(pad->avr, edgeTimer, pad);
+	avr_cycle_timer_cancel(pad->avr, silenceTimer, pad);
+	pad->receiving = 0;
+	pad->n_edges = 0;
+	pad->next_edge = 0;
+	// Pulled up when nobody drives it
+	avr_raise_irq(pad->data_irq, 1);
+}
+
+void gcn64pad_setPak(gcn64pad_t *pad, int pak)
+{
+	if (pad->pak && !pak)
+		pad->pak_removed = 1;
+	pad->pak = pak;
+	pad->pak_probe = 0;
+	pad->rumble = 0;
+}
+
+int gcn64pad_busy(gcn64pad_t *pad)
+{
+	return pad->receiving || pad->next_edge < pad->n_edges;
+}
+
+void gcn64pad_init(gcn64pad_t *pad, avr_t *avr, int type)
+{
+	static const uint8_t gc_id[3] = { 0x09, 0x00, 0x20 };
+	static const uint8_t gc_center[10] = { 0x00, 0x80, 0x80, 0x80, 0x80, 0x80, 0x20, 0x20, 0x00, 0x00 };
+
+	memset(pad, 0, sizeof(gcn64pad_t));
+	pad->avr = avr;
+	pad->type = type;
+	pad->connected = 1;
+	pad->timing = gcn64pad_official;
+	pad->rng = 1;
+
+	if (type == GCN64PAD_GC) {
+		memcpy(pad->id, gc_id, 3);
+		memcpy(pad->status, gc_center, 8);
+		memcpy(pad->origins, gc_center, 10);
+	}
+
+	pad->data_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), DATA_PIN);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), IOPORT_IRQ_DIRECTION_ALL),
+							directionNotify, pad);
+
+	gcn64pad_reset(pad);
+}
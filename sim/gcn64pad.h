@@ -0,0 +1,97 @@
+#ifndef _gcn64pad_h__
+#define _gcn64pad_h__
+
+#include <stdint.h>
+#include <simavr/sim_avr.h>
+
+/* N64 or Gamecube controller on the joybus data line used by
+ * gcn64_protocol.c (PC3, open drain).
+ *
+ * The firmware pulls the line low by setting the DDR bit, so commands
+ * are decoded from the direction changes. Each bit is a low pulse:
+ * short for 1, long for 0, and a short one after the last byte is the
+ * stop bit. The reply is sent by driving the pin input, edge by edge,
+ * with the timings of the selected profile. */
+
+#define GCN64PAD_N64			0
+#define GCN64PAD_GC				1
+
+#define GCN64PAD_PAK_NONE		0
+#define GCN64PAD_PAK_RUMBLE		1
+#define GCN64PAD_PAK_MEMORY		2
+
+#define GCN64PAD_MAX_BYTES		40	// Longest message: Expansion write (35 bytes)
+#define GCN64PAD_MAX_EDGES		((GCN64PAD_MAX_BYTES * 8 + 1) * 2)
+
+struct gcn64pad_timing {
+	const char *name;
+	uint32_t short_ns;		// Low time of a 1, high time of a 0
+	uint32_t long_ns;		// Low time of a 0, high time of a 1
+	uint32_t stop_ns;		// Low time of the stop bit
+	uint32_t turnaround_ns;	// From the end of the command to the reply
+};
+
+/* Official controllers: 1us/3us. HORI pads: 1.5us/4.5us. */
+extern const struct gcn64pad_timing gcn64pad_official;
+extern const struct gcn64pad_timing gcn64pad_hori;
+
+struct gcn64pad_edge {
+	avr_cycle_count_t when;
+	uint8_t level;
+};
+
+typedef struct gcn64pad {
+	avr_t *avr;
+	struct avr_irq_t *data_irq;
+
+	int type;
+	int connected;
+	int pak;
+	int pak_removed;
+	struct gcn64pad_timing timing;
+	uint32_t jitter_ns;			// Each low or high time is off by up to this
+	double bit_error_rate;		// Probability of sending a bit inverted
+
+	uint8_t id[3];
+	uint8_t status[8];			// N64: 4 bytes, Gamecube: 8 bytes
+	uint8_t origins[10];
+	int rumble;
+	uint8_t pak_probe;			// Last byte written at 0x8000 (rumble pak)
+	uint8_t mem[32768];			// Memory pak contents
+
+	// Command from the firmware
+	int receiving;
+	int line_low;
+	avr_cycle_count_t fall;
+	uint8_t cmd[GCN64PAD_MAX_BYTES];
+	int cmd_bits;
+
+	// Reply. reply[] holds the intended bits, before error injection.
+	uint8_t reply[GCN64PAD_MAX_BYTES];
+	int reply_bits;
+	struct gcn64pad_edge edges[GCN64PAD_MAX_EDGES];
+	int n_edges, next_edge;
+
+	// Bus time of the last transaction
+	avr_cycle_count_t first_edge, last_edge;
+
+	unsigned long commands, replies, unknown, framing_errors, collisions;
+	unsigned long flipped_bits, addr_crc_errors;
+
+	unsigned long rng;
+} gcn64pad_t;
+
+void gcn64pad_init(gcn64pad_t *pad, avr_t *avr, int type);
+/* Abandon any command or reply in progress and release the line */
+void gcn64pad_reset(gcn64pad_t *pad);
+/* Plugging or unplugging a pak */
+void gcn64pad_setPak(gcn64pad_t *pad, int pak);
+/* Nonzero while a command is being received or a reply sent */
+int gcn64pad_busy(gcn64pad_t *pad);
+
+/* The checksums of the expansion port protocol. The address is the
+ * 32 byte aligned address (the 5 low bits are ignored). */
+uint8_t gcn64pad_addrCrc(uint16_t addr);
+uint8_t gcn64pad_dataCrc(const uint8_t *data);
+
+#endif // _gcn64pad_h__
@@ -0,0 +1,265 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_time.h>
+#include "fw.h"
+#include "gcn64pad.h"
+
+/* gcn64_transaction() against simulated N64 and Gamecube controllers.
+ *
+ * Each command is sent many times with random controller contents. A
+ * transaction succeeds when the firmware returns the right number of
+ * bits and they match what the controller meant to send. */
+
+#define MAX_CYCLES		200000
+
+struct joy_case {
+	const char *name;
+	int type;
+	uint8_t cmd[GCN64PAD_MAX_BYTES];
+	int cmd_len;
+	int reply_bits;
+};
+
+static const struct joy_case cases[] = {
+	{ "n64_caps",		GCN64PAD_N64, { 0x00 }, 1, 24 },
+	{ "n64_status",		GCN64PAD_N64, { 0x01 }, 1, 32 },
+	// The rumble pak init write, as done by n64.c
+	{ "n64_exp_write",	GCN64PAD_N64, { 0x03, 0x80, 0x01,
+			0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+			0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80 }, 35, 8 },
+	{ "n64_exp_read",	GCN64PAD_N64, { 0x02, 0x80, 0x01 }, 3, 264 },
+	{ "gc_getid",		GCN64PAD_GC, { 0x00 }, 1, 24 },
+	{ "gc_status",		GCN64PAD_GC, { 0x40, 0x03, 0x00 }, 3, 64 },
+	{ "gc_status_rumble",GCN64PAD_GC, { 0x40, 0x03, 0x01 }, 3, 64 },
+	{ "gc_origins",		GCN64PAD_GC, { 0x41 }, 1, 80 },
+};
+#define N_CASES	(sizeof(cases) / sizeof(cases[0]))
+
+struct results {
+	unsigned long n, timeouts, bad_length, bad_data, flipped;
+	double call_us_sum, call_us_max, bus_us_sum;
+};
+
+static unsigned long seed = 1;
+
+/* Use gcn64_transactionChecked() with the reply length (-x) */
+static int checked;
+
+static unsigned char rnd8(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+static void randomizePad(gcn64pad_t *pad)
+{
+	int i;
+
+	for (i=0; i<8; i++)
+		pad->status[i] = rnd8();
+
+	if (pad->type == GCN64PAD_GC) {
+		// 3 fixed zeros, the origin flag, 5 buttons. Then a fixed 1.
+		pad->status[0] &= 0x1f;
+		pad->status[1] |= 0x80;
+		for (i=0; i<10; i++)
+			pad->origins[i] = rnd8();
+	} else {
+		// Bit 9 is always 0
+		pad->status[1] &= ~0x40;
+	}
+}
+
+/* The received bits, as gcn64_transaction leaves them in gcn64_workbuf:
+ * Packed, first bit in the most significant bit. */
+static void readReply(avr_t *avr, uint8_t *dst, int bits)
+{
+	fw_peek(avr, fw_sym("gcn64_workbuf"), dst, (bits + 7) / 8);
+}
+
+static int runCase(avr_t *avr, gcn64pad_t *pad, const struct joy_case *c, struct results *res)
+{
+	uint32_t transaction = fw_sym(checked ? "gcn64_transactionChecked" : "gcn64_transaction");
+	uint16_t buf = fw_scratch();
+	uint16_t args[4] = { buf, c->cmd_len, c->reply_bits, 0 };
+	uint8_t got[GCN64PAD_MAX_BYTES];
+	unsigned long flipped;
+	long cycles;
+	int bits;
+
+	randomizePad(pad);
+	gcn64pad_reset(pad);
+	fw_poke(avr, buf, c->cmd, c->cmd_len);
+
+	flipped = pad->flipped_bits;
+	pad->reply_bits = 0;
+
+	cycles = fw_call(avr, transaction, checked ? 4 : 2, args, MAX_CYCLES);
+	if (cycles < 0) {
+		fprintf(stderr, "%s: transaction did not return\n", c->name);
+		return -1;
+	}
+
+	res->n++;
+	res->call_us_sum += cycles * 1000000.0 / avr->frequency;
+	if (cycles * 1000000.0 / avr->frequency > res->call_us_max)
+		res->call_us_max = cycles * 1000000.0 / avr->frequency;
+	res->bus_us_sum += avr_cycles_to_nsec(avr, pad->last_edge - pad->first_edge) / 1000.0;
+	if (pad->flipped_bits != flipped)
+		res->flipped++;
+
+	bits = (int16_t)fw_retval(avr);
+	if (bits == 0) {
+		res->timeouts++;
+	} else if (bits != pad->reply_bits) {
+		res->bad_length++;
+	} else {
+		readReply(avr, got, bits);
+		if (memcmp(got, pad->reply, bits / 8))
+			res->bad_data++;
+	}
+
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("Usage: ./joybench [options] firmware.elf\n");
+	printf("\n");
+	printf(" -p name    Timing profile: official, hori or all (default: all)\n");
+	printf(" -j ns      Jitter on every low and high time (default: 0)\n");
+	printf(" -e rate    Probability of each reply bit being inverted (default: 0)\n");
+	printf(" -n count   Transactions per command (default: 200)\n");
+	printf(" -k pak     N64 expansion: none, rumble or memory (default: rumble)\n");
+	printf(" -x         Pass the reply length (gcn64_transactionChecked)\n");
+	printf(" -m mcu     MCU (default: atmega168)\n");
+	printf(" -f freq    Frequency (default: 12000000)\n");
+}
+
+int main(int argc, char **argv)
+{
+	static gcn64pad_t n64pad, gcpad;
+	const struct gcn64pad_timing *profiles[2] = { &gcn64pad_official, &gcn64pad_hori };
+	const char *profile = "all";
+	const char *mmcu = "atmega168";
+	uint32_t freq = 12000000;
+	uint32_t jitter_ns = 0;
+	double error_rate = 0;
+	int count = 200, pak = GCN64PAD_PAK_RUMBLE;
+	unsigned long failures = 0;
+	unsigned int i, p;
+	avr_t *avr;
+	int opt, n;
+
+	while ((opt = getopt(argc, argv, "p:j:e:n:k:m:f:xh")) != -1) {
+		switch (opt)
+		{
+			case 'p': profile = optarg; break;
+			case 'j': jitter_ns = atoi(optarg); break;
+			case 'e': error_rate = atof(optarg); break;
+			case 'n': count = atoi(optarg); break;
+			case 'k':
+				if (!strcmp(optarg, "none")) pak = GCN64PAD_PAK_NONE;
+				else if (!strcmp(optarg, "rumble")) pak = GCN64PAD_PAK_RUMBLE;
+				else if (!strcmp(optarg, "memory")) pak = GCN64PAD_PAK_MEMORY;
+				else { usage(); return 1; }
+				break;
+			case 'x': checked = 1; break;
+			case 'm': mmcu = optarg; break;
+			case 'f': freq = strtoul(optarg, NULL, 0); break;
+			case 'h': usage(); return 0;
+			default: usage(); return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+		return 1;
+	}
+
+	avr = fw_load(argv[optind], mmcu, freq);
+	if (!avr)
+		return 1;
+
+	if (fw_sym("gcn64_transaction") == FW_NO_SYMBOL || fw_sym("gcn64_transactionChecked") == FW_NO_SYMBOL ||
+			fw_sym("gcn64protocol_hwinit") == FW_NO_SYMBOL || fw_sym("timebase_init") == FW_NO_SYMBOL) {
+		fprintf(stderr, "gcn64_transaction(Checked), gcn64protocol_hwinit or timebase_init not found\n");
+		return 1;
+	}
+	// The pause between transactions is timed with Timer1
+	fw_call(avr, fw_sym("timebase_init"), 0, NULL, MAX_CYCLES);
+	// Data line as input, port bit low (open drain)
+	fw_call(avr, fw_sym("gcn64protocol_hwinit"), 0, NULL, MAX_CYCLES);
+
+	// Both controllers on the same line, only one enabled at a time
+	gcn64pad_init(&n64pad, avr, GCN64PAD_N64);
+	gcn64pad_init(&gcpad, avr, GCN64PAD_GC);
+	gcn64pad_setPak(&n64pad, pak);
+
+	printf("jitter: %u ns, bit error rate: %g, %d transactions per command\n", jitter_ns, error_rate, count);
+	printf("%-9s %-17s %6s %6s %6s %6s %6s %7s %9s %9s %9s\n", "profile", "case", "n",
+		"tmout", "length", "data", "flip", "fail%", "call avg", "call max", "bus avg");
+
+	for (p=0; p<2; p++) {
+		if (strcmp(profile, "all") && strcmp(profile, profiles[p]->name))
+			continue;
+
+		for (i=0; i<N_CASES; i++) {
+			const struct joy_case *c = &cases[i];
+			gcn64pad_t *pad = c->type == GCN64PAD_GC ? &gcpad : &n64pad;
+			gcn64pad_t *other = c->type == GCN64PAD_GC ? &n64pad : &gcpad;
+			struct results res;
+			unsigned long failed;
+
+			// The other controller is unplugged
+			other->connected = 0;
+			pad->connected = 1;
+			pad->timing = *profiles[p];
+			pad->jitter_ns = jitter_ns;
+			pad->bit_error_rate = error_rate;
+
+			memset(&res, 0, sizeof(res));
+			for (n=0; n<count; n++) {
+				if (runCase(avr, pad, c, &res))
+					return 1;
+			}
+
+			failed = res.timeouts + res.bad_length + res.bad_data;
+			failures += failed;
+
+			printf("%-9s %-17s %6lu %6lu %6lu %6lu %6lu %6.2f%% %6.1f us %6.1f us %6.1f us\n",
+				profiles[p]->name, c->name, res.n, res.timeouts, res.bad_length, res.bad_data,
+				res.flipped, failed * 100.0 / res.n, res.call_us_sum / res.n, res.call_us_max,
+				res.bus_us_sum / res.n);
+		}
+	}
+
+	printf("Collisions: %lu, framing errors: %lu, bad address checksums: %lu\n",
+		n64pad.collisions + gcpad.collisions, n64pad.framing_errors + gcpad.framing_errors,
+		n64pad.addr_crc_errors);
+
+	// With perfect timings, everything must work
+	if (!jitter_ns && error_rate == 0 && failures)
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,291 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_time.h>
+#include <simavr/avr_ioport.h>
+#include "fw.h"
+#include "gcn64pad.h"
+
+/* Checks the waveform of the commands sent by gcn64_transaction(): Every
+ * low level must last 1us (1) or 3us (0), every bit 4us, and the stop
+ * bit must be a 1us low level. The trace can be saved as a VCD file.
+ *
+ * Run it on builds for each supported F_CPU (make waves). */
+
+#define MAX_CYCLES		200000
+#define MAX_EDGES		4096
+
+#define DATA_PIN		3
+
+struct edge {
+	avr_cycle_count_t when;
+	uint8_t signal;		// 0: firmware output, 1: line level (from the controller model)
+	uint8_t level;
+};
+
+struct wave_case {
+	const char *name;
+	int type;
+	uint8_t cmd[GCN64PAD_MAX_BYTES];
+	int cmd_len;
+};
+
+static const struct wave_case cases[] = {
+	{ "n64_caps",		GCN64PAD_N64, { 0x00 }, 1 },
+	{ "n64_status",		GCN64PAD_N64, { 0x01 }, 1 },
+	{ "gc_status",		GCN64PAD_GC, { 0x40, 0x03, 0x01 }, 3 },
+	// Every bit pattern around byte boundaries
+	{ "n64_exp_write",	GCN64PAD_N64, { 0x03, 0xc0, 0x1b,
+			0x00,0xff,0x55,0xaa,0x01,0x80,0xfe,0x7f,0x0f,0xf0,0x33,0xcc,0x00,0x00,0xff,0xff,
+			0x81,0x18,0x42,0x24,0x99,0x66,0xc3,0x3c,0x12,0x34,0x56,0x78,0x9a,0xbc,0xde,0xf0 }, 35 },
+};
+#define N_CASES	(sizeof(cases) / sizeof(cases[0]))
+
+static struct edge edges[MAX_EDGES];
+static int n_edges;
+static int host_low;
+static avr_t *avr;
+
+static void addEdge(int signal, int level)
+{
+	if (n_edges < MAX_EDGES) {
+		edges[n_edges].when = avr->cycle;
+		edges[n_edges].signal = signal;
+		edges[n_edges].level = level;
+		n_edges++;
+	}
+}
+
+static void directionNotify(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	int low = (value >> DATA_PIN) & 1;
+
+	if (low != host_low) {
+		host_low = low;
+		addEdge(0, !low);
+	}
+}
+
+static void pinNotify(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	// Driven by the controller model, released to 1 by its pull-up
+	addEdge(1, value & 1);
+}
+
+static double usecs(avr_cycle_count_t c)
+{
+	return avr_cycles_to_nsec(avr, c) / 1000.0;
+}
+
+static int checkWidth(const char *case_name, int bit, const char *what, double got, double expected,
+						double tolerance, double *worst)
+{
+	if (fabs(got - expected) > *worst)
+		*worst = fabs(got - expected);
+
+	if (fabs(got - expected) > tolerance) {
+		printf("%s: bit %d: %s is %.3f us, expected %.3f us\n", case_name, bit, what, got, expected);
+		return 1;
+	}
+	return 0;
+}
+
+/* Check the firmware output (signal 0) of one command */
+static int checkCommand(const struct wave_case *c, double tolerance, double *worst)
+{
+	avr_cycle_count_t falls[GCN64PAD_MAX_BYTES * 8 + 1], rises[GCN64PAD_MAX_BYTES * 8 + 1];
+	uint8_t decoded[GCN64PAD_MAX_BYTES];
+	int n_falls = 0, n_rises = 0;
+	int i, bit, errors = 0;
+	double low, period;
+
+	for (i=0; i<n_edges; i++) {
+		if (edges[i].signal != 0)
+			continue;
+		if (!edges[i].level && n_falls < c->cmd_len * 8 + 1)
+			falls[n_falls++] = edges[i].when;
+		if (edges[i].level && n_rises < n_falls)
+			rises[n_rises++] = edges[i].when;
+	}
+
+	if (n_falls != c->cmd_len * 8 + 1 || n_rises != n_falls) {
+		printf("%s: %d low levels, expected %d\n", c->name, n_falls, c->cmd_len * 8 + 1);
+		return 1;
+	}
+
+	memset(decoded, 0, sizeof(decoded));
+	for (i=0; i<n_falls; i++) {
+		low = usecs(rises[i] - falls[i]);
+
+		if (i == n_falls - 1) {
+			errors += checkWidth(c->name, i, "stop bit low", low, 1.0, tolerance, worst);
+			break;
+		}
+
+		bit = c->cmd[i/8] & (0x80 >> (i%8));
+		if (bit)
+			decoded[i/8] |= 0x80 >> (i%8);
+		errors += checkWidth(c->name, i, bit ? "1 low" : "0 low", low, bit ? 1.0 : 3.0, tolerance, worst);
+
+		period = usecs(falls[i+1] - falls[i]);
+		errors += checkWidth(c->name, i, "period", period, 4.0, tolerance, worst);
+	}
+
+	if (memcmp(decoded, c->cmd, c->cmd_len)) {
+		printf("%s: wrong bits sent\n", c->name);
+		errors++;
+	}
+
+	return errors;
+}
+
+/* Append the edges of the last transaction, starting at 'start' ns */
+static void writeVcd(FILE *fptr, uint64_t start)
+{
+	int i;
+
+	for (i=0; i<n_edges; i++) {
+		fprintf(fptr, "#%llu\n%d%c\n", (unsigned long long)(start + avr_cycles_to_nsec(avr, edges[i].when - edges[0].when)),
+			edges[i].level, edges[i].signal ? 'p' : 'f');
+	}
+}
+
+static void usage(void)
+{
+	printf("Usage: ./joywave [options] firmware.elf\n");
+	printf("\n");
+	printf(" -f freq    Frequency the firmware was built for (default: 12000000)\n");
+	printf(" -t ns      Tolerance (default: 100)\n");
+	printf(" -o file    Write the trace to a VCD file\n");
+	printf(" -m mcu     MCU (default: atmega168)\n");
+}
+
+int main(int argc, char **argv)
+{
+	static gcn64pad_t pads[2];
+	const char *mmcu = "atmega168";
+	const char *vcd_file = NULL;
+	uint32_t freq = 12000000;
+	double tolerance = 0.1, worst = 0;
+	uint64_t vcd_time = 1000;
+	FILE *vcd = NULL;
+	int opt, errors = 0;
+	unsigned int i;
+
+	while ((opt = getopt(argc, argv, "f:t:o:m:h")) != -1) {
+		switch (opt)
+		{
+			case 'f': freq = strtoul(optarg, NULL, 0); break;
+			case 't': tolerance = atof(optarg) / 1000.0; break;
+			case 'o': vcd_file = optarg; break;
+			case 'm': mmcu = optarg; break;
+			case 'h': usage(); return 0;
+			default: usage(); return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+		return 1;
+	}
+
+	avr = fw_load(argv[optind], mmcu, freq);
+	if (!avr)
+		return 1;
+
+	if (fw_sym("gcn64_transaction") == FW_NO_SYMBOL || fw_sym("gcn64protocol_hwinit") == FW_NO_SYMBOL ||
+			fw_sym("timebase_init") == FW_NO_SYMBOL) {
+		fprintf(stderr, "gcn64_transaction, gcn64protocol_hwinit or timebase_init not found\n");
+		return 1;
+	}
+	fw_call(avr, fw_sym("timebase_init"), 0, NULL, MAX_CYCLES);
+	fw_call(avr, fw_sym("gcn64protocol_hwinit"), 0, NULL, MAX_CYCLES);
+
+	gcn64pad_init(&pads[GCN64PAD_N64], avr, GCN64PAD_N64);
+	gcn64pad_init(&pads[GCN64PAD_GC], avr, GCN64PAD_GC);
+
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), IOPORT_IRQ_DIRECTION_ALL),
+							directionNotify, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), DATA_PIN),
+							pinNotify, NULL);
+
+	if (vcd_file) {
+		vcd = fopen(vcd_file, "w");
+		if (!vcd) {
+			perror(vcd_file);
+			return 1;
+		}
+		fprintf(vcd, "$timescale 1ns $end\n");
+		fprintf(vcd, "$scope module joybus $end\n");
+		fprintf(vcd, "$var wire 1 f firmware $end\n");
+		fprintf(vcd, "$var wire 1 p line $end\n");
+		fprintf(vcd, "$upscope $end\n$enddefinitions $end\n");
+		fprintf(vcd, "#0\n1f\n1p\n");
+	}
+
+	printf("F_CPU %u Hz, tolerance %.0f ns\n", freq, tolerance * 1000);
+
+	for (i=0; i<N_CASES; i++) {
+		const struct wave_case *c = &cases[i];
+		uint16_t buf = fw_scratch();
+		uint16_t args[2] = { buf, c->cmd_len };
+		double case_worst = 0;
+		int bits, case_errors;
+
+		pads[c->type].connected = 1;
+		pads[!c->type].connected = 0;
+		gcn64pad_reset(&pads[c->type]);
+
+		n_edges = 0;
+		fw_poke(avr, buf, c->cmd, c->cmd_len);
+		if (fw_call(avr, fw_sym("gcn64_transaction"), 2, args, MAX_CYCLES) < 0) {
+			printf("%s: gcn64_transaction did not return\n", c->name);
+			return 1;
+		}
+		bits = (int16_t)fw_retval(avr);
+
+		case_errors = checkCommand(c, tolerance, &case_worst);
+		if (bits != pads[c->type].reply_bits) {
+			printf("%s: %d bits received, expected %d\n", c->name, bits, pads[c->type].reply_bits);
+			case_errors++;
+		}
+		errors += case_errors;
+		if (case_worst > worst)
+			worst = case_worst;
+
+		printf("%-16s %s (worst error %.0f ns)\n", c->name, case_errors ? "FAIL" : "ok", case_worst * 1000);
+
+		if (vcd && n_edges) {
+			// One transaction after the other, 20us apart
+			writeVcd(vcd, vcd_time);
+			vcd_time += avr_cycles_to_nsec(avr, edges[n_edges-1].when - edges[0].when) + 20000;
+		}
+	}
+
+	if (vcd)
+		fclose(vcd);
+
+	printf("Worst error: %.0f ns, %s\n", worst * 1000, errors ? "FAIL" : "ok");
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_io.h>
+#include <simavr/avr_ioport.h>
+#include "snespad.h"
+
+#define LATCH_PIN	1
+#define CLOCK_PIN	0
+#define DATA_PIN	2
+
+static void output(snespad_t *pad)
+{
+	avr_raise_irq(pad->data_irq, pad->shift & 1);
+}
+
+static void latchNotify(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	snespad_t *pad = param;
+
+	pad->latch = value;
+	if (value) {
+		// Pressed buttons are low. The last 4 bits are always high on a
+		// SNES controller (the firmware uses this to tell it from a NES one).
+		pad->shift = ~pad->buttons | 0xf000;
+		pad->latches++;
+		pad->last_latch = pad->avr->cycle;
+		output(pad);
+	}
+}
+
+static void clockNotify(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	snespad_t *pad = param;
+
+	// Next bit on the rising edge. Once all bits are out, the line stays low.
+	if (value && !pad->clock && !pad->latch) {
+		pad->shift >>= 1;
+		output(pad);
+	}
+	pad->clock = value;
+}
+
+void snespad_init(snespad_t *pad, avr_t *avr)
+{
+	memset(pad, 0, sizeof(snespad_t));
+	pad->avr = avr;
+	pad->clock = 1;
+	pad->shift = 0xffff;
+	pad->data_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), DATA_PIN);
+
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), LATCH_PIN), latchNotify, pad);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), CLOCK_PIN), clockNotify, pad);
+	output(pad);
+}
+
+void snespad_set(snespad_t *pad, uint16_t buttons)
+{
+	pad->buttons = buttons;
+}
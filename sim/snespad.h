@@ -0,0 +1,41 @@
+#ifndef _snespad_h__
+#define _snespad_h__
+
+#include <stdint.h>
+#include <simavr/sim_avr.h>
+
+/* SNES controller on the latch, clock and data pins used by snes.c.
+ *
+ * Buttons use the order they are shifted out in, bit 0 first:
+ * B, Y, Select, Start, Up, Down, Left, Right, A, X, L, R. A set bit
+ * means pressed (low on the wire). */
+
+#define SNESPAD_B		0x0001
+#define SNESPAD_Y		0x0002
+#define SNESPAD_SELECT	0x0004
+#define SNESPAD_START	0x0008
+#define SNESPAD_UP		0x0010
+#define SNESPAD_DOWN	0x0020
+#define SNESPAD_LEFT	0x0040
+#define SNESPAD_RIGHT	0x0080
+#define SNESPAD_A		0x0100
+#define SNESPAD_X		0x0200
+#define SNESPAD_L		0x0400
+#define SNESPAD_R		0x0800
+
+typedef struct snespad {
+	avr_t *avr;
+	struct avr_irq_t *data_irq;
+	uint16_t buttons;
+	uint16_t shift;		// Wire levels still to shift out, bit 0 first
+	int latch, clock;
+
+	unsigned long latches;
+	avr_cycle_count_t last_latch;
+} snespad_t;
+
+/* Latch PC1, clock PC0, data PC2 */
+void snespad_init(snespad_t *pad, avr_t *avr);
+void snespad_set(snespad_t *pad, uint16_t buttons);
+
+#endif // _snespad_h__
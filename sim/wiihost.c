@@ -0,0 +1,346 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_time.h>
+#include <simavr/sim_cycle_timers.h>
+#include "fw.h"
+#include "wiimaster.h"
+#include "snespad.h"
+
+/* The firmware with a SNES controller, polled by a simulated wiimote.
+ *
+ * The B button toggles at intervals unrelated to the poll period. The
+ * time from each change to the first byte served to the wiimote that
+ * reflects it is the end-to-end latency. */
+
+#define WM_ADDR				0x52
+#define BITRATE				400000
+#define POLL_PERIOD_US		5000
+#define TOGGLE_PERIOD_US	37300	// Not a multiple of the poll period
+#define BOOT_US				50000
+
+#define HIST_BUCKET_US		500
+#define HIST_BUCKETS		40
+
+#define SCENARIO_PLAIN		0
+#define SCENARIO_ENCRYPTED	1
+#define SCENARIO_NESCLASSIC	2
+
+static const char *scenario_names[] = { "plain", "encrypted", "nesclassic" };
+
+struct host {
+	avr_t *avr;
+	wiimaster_t master;
+	snespad_t pad;
+	int scenario;
+	int verbose;
+	int polling;
+	double max_stretch_us;	// Fail above this, if set
+
+	uint8_t report[32];
+	avr_cycle_count_t report_times[32];
+	int report_len;
+	int enc_on;
+
+	// Last input change not seen yet by the host
+	int pending;
+	int expected_b;
+	avr_cycle_count_t change_time;
+
+	unsigned long reads;
+	unsigned long hist[HIST_BUCKETS + 1];
+	unsigned long n_lat;
+	double lat_min, lat_max, lat_sum;
+
+	unsigned long rng;
+};
+
+static unsigned long rng(struct host *h)
+{
+	h->rng = h->rng * 1103515245 + 12345;
+	return (h->rng >> 16) & 0x7fff;
+}
+
+static double usec(avr_t *avr, avr_cycle_count_t c)
+{
+	return (double)c * 1000000.0 / avr->frequency;
+}
+
+static void hostWrite(struct host *h, const uint8_t *data, int len)
+{
+	wiimaster_write(&h->master, data, len);
+	wiimaster_wait(&h->master, 1000);
+}
+
+static void queueInit(struct host *h)
+{
+	static const uint8_t key[16] = {
+		0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+		0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10
+	};
+	uint8_t buf[8];
+
+	wiimaster_wait(&h->master, BOOT_US);
+
+	switch (h->scenario)
+	{
+		case SCENARIO_PLAIN:
+			hostWrite(h, (uint8_t[]){ 0xf0, 0x55 }, 2);
+			hostWrite(h, (uint8_t[]){ 0xfb, 0x00 }, 2);
+			break;
+
+		case SCENARIO_ENCRYPTED:
+			hostWrite(h, (uint8_t[]){ 0xf0, 0xaa }, 2);
+			// The key goes in 3 writes, the wiimote does not write more than 6 bytes at once
+			buf[0] = 0x40; memcpy(buf + 1, key, 6); hostWrite(h, buf, 7);
+			buf[0] = 0x46; memcpy(buf + 1, key + 6, 6); hostWrite(h, buf, 7);
+			buf[0] = 0x4c; memcpy(buf + 1, key + 12, 4); hostWrite(h, buf, 5);
+			h->enc_on = 1;
+			break;
+
+		case SCENARIO_NESCLASSIC:
+			// See notes_nes_classic.txt
+			hostWrite(h, NULL, 0); // address only
+			hostWrite(h, (uint8_t[]){ 0xf0, 0x55 }, 2);
+			hostWrite(h, (uint8_t[]){ 0xfb, 0x00 }, 2);
+			hostWrite(h, (uint8_t[]){ 0xfe, 0x03 }, 2);
+			break;
+	}
+
+	// Extension id
+	hostWrite(h, (uint8_t[]){ 0xfa }, 1);
+	wiimaster_read(&h->master, 6);
+	wiimaster_kick(&h->master);
+}
+
+static avr_cycle_count_t pollTimer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	struct host *h = param;
+
+	if (!wiimaster_idle(&h->master)) {
+		// Still busy with the previous transfers (init, or heavy stretching)
+		return when + avr_usec_to_cycles(avr, POLL_PERIOD_US);
+	}
+
+	h->polling = 1;
+	wiimaster_write(&h->master, (uint8_t[]){ 0x00 }, 1);
+	wiimaster_read(&h->master, h->scenario == SCENARIO_NESCLASSIC ? 21 : 6);
+	wiimaster_kick(&h->master);
+
+	return when + avr_usec_to_cycles(avr, POLL_PERIOD_US);
+}
+
+static avr_cycle_count_t toggleTimer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	struct host *h = param;
+	uint32_t next;
+
+	h->expected_b = !h->expected_b;
+	snespad_set(&h->pad, h->expected_b ? SNESPAD_B : 0);
+	h->change_time = avr->cycle;
+	h->pending = 1;
+
+	next = TOGGLE_PERIOD_US + rng(h) % 1000;
+	return when + avr_usec_to_cycles(avr, next);
+}
+
+static void onByte(wiimaster_t *m, uint8_t reg, uint8_t data, avr_cycle_count_t when, void *param)
+{
+	struct host *h = param;
+
+	if (h->verbose) {
+		printf("%12.1f us  reg %02x  %02x\n", usec(h->avr, when), reg, data);
+	}
+
+	if (h->enc_on) {
+		uint8_t ft[8], sb[8];
+
+		// Tables generated by the firmware from the key
+		fw_peek(h->avr, fw_sym("wm_ft"), ft, 8);
+		fw_peek(h->avr, fw_sym("wm_sb"), sb, 8);
+		data = (data ^ sb[reg % 8]) + ft[reg % 8];
+	}
+
+	if (reg < sizeof(h->report)) {
+		h->report[reg] = data;
+		h->report_times[reg] = when;
+		if (reg >= h->report_len)
+			h->report_len = reg + 1;
+	}
+}
+
+static void onReadDone(wiimaster_t *m, avr_cycle_count_t when, void *param)
+{
+	struct host *h = param;
+	int byte, b_pressed;
+	double lat;
+
+	if (!h->polling || !h->report_len) {
+		h->report_len = 0;
+		return;
+	}
+	h->reads++;
+
+	// Classic controller B button, active low.
+	byte = h->scenario == SCENARIO_NESCLASSIC ? 7 : 5;
+	if (byte >= h->report_len) {
+		h->report_len = 0;
+		return;
+	}
+	b_pressed = !(h->report[byte] & 0x40);
+
+	if (h->pending && b_pressed == h->expected_b) {
+		lat = usec(h->avr, h->report_times[byte] - h->change_time);
+		h->pending = 0;
+
+		if (h->n_lat == 0 || lat < h->lat_min) h->lat_min = lat;
+		if (lat > h->lat_max) h->lat_max = lat;
+		h->lat_sum += lat;
+		h->n_lat++;
+
+		if (lat / HIST_BUCKET_US >= HIST_BUCKETS)
+			h->hist[HIST_BUCKETS]++;
+		else
+			h->hist[(int)(lat / HIST_BUCKET_US)]++;
+	}
+
+	h->report_len = 0;
+}
+
+static void printResults(struct host *h)
+{
+	int i;
+	unsigned long max = 1;
+
+	printf("Scenario: %s\n", scenario_names[h->scenario]);
+	printf("Reports read: %lu, NAKs: %lu, timeouts: %lu, latches: %lu\n",
+		h->reads, h->master.naks, h->master.timeouts, h->pad.latches);
+	printf("Longest clock stretch: %.0f us\n", usec(h->avr, h->master.max_stretch));
+
+	if (!h->n_lat) {
+		printf("No input change reached the host!\n");
+		return;
+	}
+
+	printf("Latency (input change to first byte reflecting it): min %.0f us, avg %.0f us, max %.0f us (%lu changes)\n",
+		h->lat_min, h->lat_sum / h->n_lat, h->lat_max, h->n_lat);
+
+	for (i=0; i<=HIST_BUCKETS; i++) {
+		if (h->hist[i] > max)
+			max = h->hist[i];
+	}
+	for (i=0; i<=HIST_BUCKETS; i++) {
+		int bar;
+
+		if (!h->hist[i])
+			continue;
+		bar = h->hist[i] * 50 / max;
+		if (i == HIST_BUCKETS)
+			printf("     >= %5d us %6lu ", i * HIST_BUCKET_US, h->hist[i]);
+		else
+			printf("%5d - %5d us %6lu ", i * HIST_BUCKET_US, (i+1) * HIST_BUCKET_US, h->hist[i]);
+		while (bar--)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+static void usage(void)
+{
+	printf("Usage: ./wiihost [options] firmware.elf\n");
+	printf("\n");
+	printf(" -s name    Scenario: plain, encrypted or nesclassic (default: plain)\n");
+	printf(" -t sec     Simulated time (default: 10)\n");
+	printf(" -m us      Fail if the firmware stretches the clock longer than this\n");
+	printf(" -v         Display every byte read with its timestamp\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct host h;
+	double seconds = 10;
+	avr_cycle_count_t end;
+	int opt, i, state;
+
+	h.rng = 1;
+
+	while ((opt = getopt(argc, argv, "s:t:m:vh")) != -1) {
+		switch (opt)
+		{
+			case 's':
+				h.scenario = -1;
+				for (i=0; i<3; i++) {
+					if (!strcmp(optarg, scenario_names[i]))
+						h.scenario = i;
+				}
+				if (h.scenario < 0) {
+					usage();
+					return 1;
+				}
+				break;
+			case 't': seconds = atof(optarg); break;
+			case 'm': h.max_stretch_us = atof(optarg); break;
+			case 'v': h.verbose = 1; break;
+			case 'h': usage(); return 0;
+			default: usage(); return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+		return 1;
+	}
+
+	h.avr = fw_load(argv[optind], "atmega168", 12000000);
+	if (!h.avr)
+		return 1;
+
+	snespad_init(&h.pad, h.avr);
+	wiimaster_init(&h.master, h.avr, WM_ADDR, BITRATE);
+	h.master.on_byte = onByte;
+	h.master.on_read_done = onReadDone;
+	h.master.param = &h;
+
+	queueInit(&h);
+	avr_cycle_timer_register_usec(h.avr, BOOT_US + 20000, pollTimer, &h);
+	avr_cycle_timer_register_usec(h.avr, BOOT_US + 30000, toggleTimer, &h);
+
+	end = h.avr->cycle + avr_usec_to_cycles(h.avr, seconds * 1000000);
+	while (h.avr->cycle < end) {
+		state = avr_run(h.avr);
+		if (state == cpu_Done || state == cpu_Crashed) {
+			fprintf(stderr, "Firmware stopped (state %d)\n", state);
+			return 1;
+		}
+	}
+
+	printResults(&h);
+
+	if (h.max_stretch_us) {
+		if (usec(h.avr, h.master.max_stretch) > h.max_stretch_us || h.master.timeouts) {
+			printf("Clock stretched longer than %.0f us!\n", h.max_stretch_us);
+			return 1;
+		}
+	}
+
+	return h.n_lat ? 0 : 1;
+}
+
@@ -0,0 +1,272 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_time.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_twi.h>
+#include "wiimaster.h"
+
+#define OP_START_W	0
+#define OP_START_R	1
+#define OP_WRITE	2
+#define OP_READ		3 // data: 1 for the last byte (NAK)
+#define OP_STOP		4
+#define OP_WAIT		5
+
+#define ST_IDLE		0
+#define ST_DELAY	1 // Waiting before the next op
+#define ST_BUS		2 // Byte being clocked on the bus
+#define ST_WAIT_ACK	3 // Waiting for the slave to ACK
+#define ST_WAIT_DATA 4 // Waiting for the slave to provide a byte
+
+/* The firmware should answer in microseconds. This is a lot of stretching. */
+#define TIMEOUT_USEC	10000
+
+static void step(wiimaster_t *m);
+
+static void queue(wiimaster_t *m, uint8_t type, uint8_t data, uint32_t usec)
+{
+	struct wiimaster_op *op;
+
+	if (m->tail - m->head >= WIIMASTER_MAX_OPS) {
+		fprintf(stderr, "wiimaster: queue full\n");
+		return;
+	}
+
+	op = &m->ops[m->tail % WIIMASTER_MAX_OPS];
+	op->type = type;
+	op->data = data;
+	op->usec = usec;
+	m->tail++;
+}
+
+static void sendMsg(wiimaster_t *m, uint8_t msg, uint8_t addr, uint8_t data)
+{
+	avr_raise_irq(m->irq_in, avr_twi_irq_msg(msg, addr, data));
+}
+
+static avr_cycle_count_t stepTimer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	step(param);
+	return 0;
+}
+
+static void delayStep(wiimaster_t *m, avr_cycle_count_t cycles)
+{
+	m->state = ST_DELAY;
+	avr_cycle_timer_register(m->avr, cycles ? cycles : 1, stepTimer, m);
+}
+
+/* Drop the rest of the current transfer, up to and including its stop */
+static void abortTransfer(wiimaster_t *m)
+{
+	while (m->head != m->tail) {
+		struct wiimaster_op *op = &m->ops[m->head % WIIMASTER_MAX_OPS];
+
+		m->head++;
+		if (op->type == OP_STOP)
+			break;
+	}
+	sendMsg(m, TWI_COND_STOP, m->addr << 1, 0);
+	delayStep(m, m->byte_cycles);
+}
+
+static avr_cycle_count_t timeoutTimer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	wiimaster_t *m = param;
+
+	m->timeouts++;
+	abortTransfer(m);
+	return 0;
+}
+
+static void waitSlave(wiimaster_t *m, int state)
+{
+	m->state = state;
+	m->wait_start = m->avr->cycle;
+	avr_cycle_timer_register_usec(m->avr, TIMEOUT_USEC, timeoutTimer, m);
+}
+
+/* The byte (address or data) has been clocked out: The slave sees it now */
+static avr_cycle_count_t busTimer(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+	wiimaster_t *m = param;
+	struct wiimaster_op *op = &m->ops[(m->head - 1) % WIIMASTER_MAX_OPS];
+
+	switch (op->type)
+	{
+		case OP_START_W:
+			sendMsg(m, TWI_COND_START | TWI_COND_ADDR, m->addr << 1, 0);
+			waitSlave(m, ST_WAIT_ACK);
+			break;
+
+		case OP_START_R:
+			sendMsg(m, TWI_COND_START | TWI_COND_ADDR, (m->addr << 1) | 1, 0);
+			waitSlave(m, ST_WAIT_ACK);
+			break;
+
+		case OP_WRITE:
+			sendMsg(m, TWI_COND_WRITE, m->addr << 1, op->data);
+			waitSlave(m, ST_WAIT_ACK);
+			break;
+
+		case OP_READ:
+			sendMsg(m, TWI_COND_READ, (m->addr << 1) | 1, 0);
+			waitSlave(m, ST_WAIT_DATA);
+			break;
+	}
+
+	return 0;
+}
+
+static void step(wiimaster_t *m)
+{
+	struct wiimaster_op *op;
+
+	if (m->head == m->tail) {
+		m->state = ST_IDLE;
+		return;
+	}
+
+	op = &m->ops[m->head % WIIMASTER_MAX_OPS];
+	m->head++;
+	m->op_start = m->avr->cycle;
+
+	switch (op->type)
+	{
+		case OP_START_W:
+			m->first_write = 1;
+			m->reading = 0;
+			break;
+		case OP_START_R:
+			m->reading = 1;
+			break;
+		case OP_WRITE:
+			if (m->first_write)
+				m->read_reg = op->data;
+			m->first_write = 0;
+			break;
+
+		case OP_STOP:
+			sendMsg(m, TWI_COND_STOP, m->addr << 1, 0);
+			if (m->reading && m->on_read_done)
+				m->on_read_done(m, m->avr->cycle, m->param);
+			m->reading = 0;
+			// Bus free time
+			delayStep(m, m->byte_cycles / 9 + 1);
+			return;
+
+		case OP_WAIT:
+			delayStep(m, avr_usec_to_cycles(m->avr, op->usec));
+			return;
+	}
+
+	m->state = ST_BUS;
+	avr_cycle_timer_register(m->avr, m->byte_cycles, busTimer, m);
+}
+
+static void slaveAnswered(wiimaster_t *m)
+{
+	avr_cycle_timer_cancel(m->avr, timeoutTimer, m);
+	if (m->avr->cycle - m->wait_start > m->max_stretch)
+		m->max_stretch = m->avr->cycle - m->wait_start;
+}
+
+/* Messages from the firmware (slave) */
+static void outputNotify(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	wiimaster_t *m = param;
+	struct wiimaster_op *op = &m->ops[(m->head - 1) % WIIMASTER_MAX_OPS];
+	avr_twi_msg_irq_t v;
+
+	v.u.v = value;
+
+	if (m->state == ST_WAIT_ACK && (v.u.twi.msg & TWI_COND_ACK)) {
+		slaveAnswered(m);
+		if (!(v.u.twi.data & 1)) {
+			m->naks++;
+			abortTransfer(m);
+			return;
+		}
+		delayStep(m, 1);
+		return;
+	}
+
+	if (m->state == ST_WAIT_DATA && (v.u.twi.msg & TWI_COND_READ)) {
+		slaveAnswered(m);
+		if (m->on_byte)
+			m->on_byte(m, m->read_reg, v.u.twi.data, m->avr->cycle, m->param);
+		m->read_reg++;
+		// ACK all but the last byte
+		sendMsg(m, TWI_COND_ACK, (m->addr << 1) | 1, op->data ? 0 : 1);
+		delayStep(m, 1);
+		return;
+	}
+}
+
+void wiimaster_init(wiimaster_t *m, avr_t *avr, uint8_t addr, uint32_t bitrate)
+{
+	memset(m, 0, sizeof(wiimaster_t));
+	m->avr = avr;
+	m->addr = addr;
+	m->byte_cycles = (uint64_t)avr->frequency * 9 / bitrate;
+	m->irq_in = avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT),
+							outputNotify, m);
+}
+
+void wiimaster_write(wiimaster_t *m, const uint8_t *data, int len)
+{
+	int i;
+
+	queue(m, OP_START_W, 0, 0);
+	for (i=0; i<len; i++) {
+		queue(m, OP_WRITE, data[i], 0);
+	}
+	queue(m, OP_STOP, 0, 0);
+}
+
+void wiimaster_read(wiimaster_t *m, int len)
+{
+	int i;
+
+	queue(m, OP_START_R, 0, 0);
+	for (i=0; i<len; i++) {
+		queue(m, OP_READ, i == len-1, 0);
+	}
+	queue(m, OP_STOP, 0, 0);
+}
+
+void wiimaster_wait(wiimaster_t *m, uint32_t usec)
+{
+	queue(m, OP_WAIT, 0, usec);
+}
+
+void wiimaster_kick(wiimaster_t *m)
+{
+	if (m->state == ST_IDLE)
+		step(m);
+}
+
+int wiimaster_idle(wiimaster_t *m)
+{
+	return m->state == ST_IDLE && m->head == m->tail;
+}
+
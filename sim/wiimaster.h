@@ -0,0 +1,62 @@
+#ifndef _wiimaster_h__
+#define _wiimaster_h__
+
+#include <stdint.h>
+#include <simavr/sim_avr.h>
+
+/* I2C master playing the part of the wiimote. Transfers are queued and
+ * executed in simulated time on the TWI peripheral of the firmware.
+ *
+ * Each byte takes 9 bit times (400kHz by default) before the slave sees
+ * it. The slave answering late (interrupt latency) is clock stretching,
+ * which delays everything that follows, like on the real bus. */
+
+#define WIIMASTER_MAX_OPS	512
+
+struct wiimaster_op {
+	uint8_t type;
+	uint8_t data;
+	uint32_t usec;
+};
+
+typedef struct wiimaster {
+	avr_t *avr;
+	struct avr_irq_t *irq_in;	// To the firmware
+	uint8_t addr;
+	uint32_t byte_cycles;
+
+	struct wiimaster_op ops[WIIMASTER_MAX_OPS];
+	int head, tail;
+
+	int state;
+	int first_write;		// Next byte written sets the register address
+	int reading;
+	uint8_t read_reg;		// Register address (as last written) of the byte being read
+	avr_cycle_count_t op_start;
+	avr_cycle_count_t wait_start;
+
+	unsigned long naks, timeouts;
+	avr_cycle_count_t max_stretch;	// Longest wait for the slave, in cycles
+
+	/* Called for every byte received from the slave */
+	void (*on_byte)(struct wiimaster *m, uint8_t reg, uint8_t data, avr_cycle_count_t when, void *param);
+	/* Called at the end (stop) of every read */
+	void (*on_read_done)(struct wiimaster *m, avr_cycle_count_t when, void *param);
+	void *param;
+} wiimaster_t;
+
+void wiimaster_init(wiimaster_t *m, avr_t *avr, uint8_t addr, uint32_t bitrate);
+
+/* Queue a write of len bytes (the first is the register address) */
+void wiimaster_write(wiimaster_t *m, const uint8_t *data, int len);
+/* Queue a read of len bytes from the current register address */
+void wiimaster_read(wiimaster_t *m, int len);
+/* Queue a pause */
+void wiimaster_wait(wiimaster_t *m, uint32_t usec);
+
+/* Start executing what is queued (if not already running) */
+void wiimaster_kick(wiimaster_t *m);
+int wiimaster_idle(wiimaster_t *m);
+
+#endif // _wiimaster_h__
+
@@ -25,10 +25,13 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/delay.h>
+#include <util/delay_basic.h>
 #include <avr/pgmspace.h>
 #include <string.h>
 #include "gamepads.h"
 #include "snes.h"
+#include "wiimote.h"
+#include "timebase.h"
 
 #define GAMEPAD_BYTES	2
 
@@ -119,45 +122,174 @@ static char snesInit(void)
  *
  */
 
-static char snesUpdate(void)
+/* Half-period delay, 3 cycles per count */
+#define HALF_PERIOD_COUNTS(us)	((us) * ((F_CPU + 2999999) / 3000000))
+
+static unsigned char slow_frames;
+static unsigned int glitches;
+
+/* Busy waiting, like the DB9 read (see db9.c): Entering
+ * and leaving an interrupt takes about as long as a half-period here. */
+static void snesRead(unsigned char *dst, unsigned char half_us)
 {
-	int i;
-	unsigned char tmp=0;
+	unsigned char i, tmp = 0, counts;
+
+	counts = HALF_PERIOD_COUNTS(half_us);
 
 	SNES_LATCH_HIGH();
-	_delay_us(12);
+	_delay_loop_1(counts);
+	_delay_loop_1(counts);
 	SNES_LATCH_LOW();
 
-	for (i=0; i<8; i++)
+	for (i=0; i<16; i++)
 	{
-		_delay_us(6);
+		_delay_loop_1(counts);
+
 		SNES_CLOCK_LOW();
 
 		tmp <<= 1;
 		if (!SNES_GET_DATA()) { tmp |= 0x01; }
 
-		_delay_us(6);
+		_delay_loop_1(counts);
 
 		SNES_CLOCK_HIGH();
+
+		if (i == 7) {
+			dst[0] = tmp;
+		}
 	}
-	last_read_controller_bytes[0] = tmp;
-	for (i=0; i<8; i++)
-	{
-		_delay_us(6);
+	dst[1] = tmp;
+}
 
-		SNES_CLOCK_LOW();
+/* The half-period to use, and whether to read twice (glitch check) */
+static unsigned char snesTiming(char *twice)
+{
+	unsigned char half_us, flags;
 
-		tmp <<= 1;
-		if (!SNES_GET_DATA()) { tmp |= 0x01; }
+	half_us = wm_getReg(SNES_REG_HALF_PERIOD);
+	if (half_us == 0 || half_us > SNES_SLOW_HALF_PERIOD_US) {
+		half_us = SNES_HALF_PERIOD_US;
+	}
+	flags = wm_getReg(SNES_REG_FLAGS) ^ SNES_DEFAULT_FLAGS;
 
-		_delay_us(6);
-		SNES_CLOCK_HIGH();
+	if (slow_frames) {
+		half_us = SNES_SLOW_HALF_PERIOD_US;
+	}
+
+	*twice = (flags & SNES_FLAG_GLITCH_CHECK) && half_us < SNES_SLOW_HALF_PERIOD_US;
+
+	return half_us;
+}
+
+/* Read with the glitch check. slow_frames is counted down by updates.
+ *
+ * After a glitch, the pad is read again at the original timing. Unless
+ * retry is 0: Then 1 is returned and dst must not be used. */
+static char snesReadChecked(unsigned char *dst, char retry)
+{
+	unsigned char half_us;
+	unsigned char check[GAMEPAD_BYTES];
+	unsigned char reg[2];
+	char twice, res = 0;
+
+	half_us = snesTiming(&twice);
+
+	snesRead(dst, half_us);
+
+	// Faster than the original timing: Read again and compare.
+	if (twice) {
+		snesRead(check, half_us);
+		if (memcmp(check, dst, GAMEPAD_BYTES)) {
+			if (glitches != 0xffff) {
+				glitches++;
+			}
+			reg[0] = glitches >> 8;
+			reg[1] = glitches;
+			wm_setRegs(SNES_REG_GLITCHES, reg, 2);
+
+			half_us = SNES_SLOW_HALF_PERIOD_US;
+			slow_frames = SNES_SLOW_FRAMES + 1;
+			if (retry) {
+				snesRead(dst, half_us);
+			} else {
+				res = 1;
+			}
+		}
+	}
+
+	wm_setRegs(SNES_REG_CUR_HALF_PERIOD, &half_us, 1);
+
+	return res;
+}
+
+#ifdef WITH_OVERSAMPLE
+// Buttons seen pressed by the samples since the last update
+static unsigned char latched[GAMEPAD_BYTES];
+
+static void snesSample(void)
+{
+	unsigned char tmp[GAMEPAD_BYTES];
+
+	snesReadChecked(tmp, 1);
+	latched[0] |= tmp[0];
+	latched[1] |= tmp[1];
+}
+#endif
+
+static char snesUpdateRetry(char retry)
+{
+	unsigned char tmp[GAMEPAD_BYTES];
+
+	if (snesReadChecked(tmp, retry)) {
+		return 1;
 	}
-	last_read_controller_bytes[1] = tmp;
+	memcpy(last_read_controller_bytes, tmp, GAMEPAD_BYTES);
+	if (slow_frames) {
+		slow_frames--;
+	}
+
+#ifdef WITH_OVERSAMPLE
+	// Presses from the samples are reported once. Releases are as of now.
+	last_read_controller_bytes[0] |= latched[0];
+	last_read_controller_bytes[1] |= latched[1];
+	latched[0] = 0;
+	latched[1] = 0;
+#endif
 
 	return 0;
 }
 
+static char snesUpdate(void)
+{
+	return snesUpdateRetry(1);
+}
+
+#ifdef WITH_FRESH_REPORT
+/* Upper bound of a snesRead(), in timebase ticks. Computed, not
+ * measured: 34 half-periods (the latch pulse is 2) and, generously, 16
+ * cycles per bit and 64 for the rest. */
+#define SNES_READ_OVERHEAD_CYCLES	(16 * 16 + 64)
+#define SNES_READ_MAX_TICKS(half_us)	\
+		((34 * 3 * HALF_PERIOD_COUNTS(half_us) + SNES_READ_OVERHEAD_CYCLES) / TIMEBASE_PRESCALER)
+
+unsigned int snesFreshMaxTicks(void)
+{
+	unsigned char half_us;
+	unsigned int ticks;
+	char twice;
+
+	half_us = snesTiming(&twice);
+	ticks = SNES_READ_MAX_TICKS(half_us);
+
+	return twice ? ticks * 2 : ticks;
+}
+
+char snesFreshUpdate(void)
+{
+	return snesUpdateRetry(0);
+}
+#endif
+
 static char snesChanged(void)
 {
 	return memcmp(last_read_controller_bytes,
@@ -207,7 +339,10 @@ static Gamepad SnesGamepad = {
 	.init		= snesInit,
 	.update		= snesUpdate,
 	.changed	= snesChanged,
-	.getReport	= snesGetReport
+	.getReport	= snesGetReport,
+#ifdef WITH_OVERSAMPLE
+	.sample		= snesSample,
+#endif
 };
 
 Gamepad *snesGetGamepad(void)
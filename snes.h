@@ -1,3 +1,49 @@
 #include "gamepads.h"
 
 Gamepad *snesGetGamepad(void);
+
+/* For fresh reports (see main.c), run in the TWI interrupt. The update
+ * does not read again after a glitch: It returns non-zero instead and
+ * the report must not be used. snesFreshMaxTicks() is how long the update
+ * may take at most with the current settings, in timebase ticks. */
+unsigned int snesFreshMaxTicks(void);
+char snesFreshUpdate(void);
+
+/* NES/SNES read timing. The original timing (12us latch pulse, 6us
+ * half-periods) reads the 16 bits in about 200us. Pads clock much faster
+ * than this, so the half-period can be reduced, down to 1us (about 40us
+ * for the read):
+ *
+ * At build time, with -DSNES_HALF_PERIOD_US=n (1 to 6, default 6), or at
+ * run time through the virtual registers (address 0x52):
+ *
+ *  0xA0       Half-period in us. 0 (default) for SNES_HALF_PERIOD_US.
+ *  0xA1       Flags, XORed with the build default (SNES_DEFAULT_FLAGS):
+ *             bit 0: Glitch check.
+ *  0xA2-0xA3  Glitches, since power up (big endian)
+ *  0xA4       Half-period in use (us)
+ *
+ * With the glitch check, the pad is read twice. If the reads disagree,
+ * the glitch is counted and the pad is read at the original timing, for
+ * this frame and the next SNES_SLOW_FRAMES. A button changing between
+ * the two reads (tens of us apart) also counts, but this is rare.
+ *
+ * The default stays at the original timing, so the faster read is opt-in
+ * only: It has not been tried on a range of pads yet. At 1us with the
+ * glitch check (two reads), a read takes about 110us instead of 200.
+ */
+#ifndef SNES_HALF_PERIOD_US
+#define SNES_HALF_PERIOD_US			6
+#endif
+#define SNES_SLOW_HALF_PERIOD_US	6
+#define SNES_SLOW_FRAMES			200
+
+#define SNES_FLAG_GLITCH_CHECK		0x01
+#ifndef SNES_DEFAULT_FLAGS
+#define SNES_DEFAULT_FLAGS			SNES_FLAG_GLITCH_CHECK
+#endif
+
+#define SNES_REG_HALF_PERIOD		0xA0
+#define SNES_REG_FLAGS				0xA1
+#define SNES_REG_GLITCHES			0xA2
+#define SNES_REG_CUR_HALF_PERIOD	0xA4
@@ -0,0 +1,132 @@
+/*  Extenmote : NES, SNES, N64 and Gamecube to Wii remote adapter firmware
+ *  Copyright (C) 2012-2015  Raphael Assenat <raph@raphnet.net>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "timebase.h"
+
+#ifndef TIMSK1 // atmega8
+#define TIMSK1	TIMSK
+#define TIFR1	TIFR
+#endif
+
+static unsigned long asleep_ticks;
+
+// Only there to wake the CPU
+EMPTY_INTERRUPT(TIMER1_COMPA_vect);
+
+void timebase_init(void)
+{
+	// Normal mode, clk/8
+	TCCR1A = 0;
+	TCCR1B = _BV(CS11);
+	TCNT1 = 0;
+}
+
+/* Safe to call from anywhere. Reading TCNT1 goes through the shared
+ * 16 bit TEMP register, so an interrupt touching Timer1 between the low
+ * and high byte reads would corrupt the result. */
+unsigned int timebase_now(void)
+{
+	unsigned char sreg;
+	unsigned int t;
+
+	sreg = SREG;
+	cli();
+	t = TCNT1;
+	SREG = sreg;
+
+	return t;
+}
+
+/* Enter idle sleep once. Must be called with interrupts disabled, and
+ * returns with interrupts disabled after the wake-up interrupt has run.
+ *
+ * Timer1 keeps running in idle mode so the time spent asleep can be
+ * accounted for. */
+void timebase_sleep(void)
+{
+	unsigned int t;
+
+	t = TCNT1;
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei(); // takes effect after the next instruction
+	sleep_cpu();
+	sleep_disable();
+	cli();
+	asleep_ticks += (unsigned int)(TCNT1 - t);
+}
+
+/* Like timebase_sleep(), in EXT_STANDBY: Draws less, but Timer1 stops
+ * meanwhile. The time asleep is lost (not counted either), so this is
+ * only for waiting on other interrupts (TWI) when nothing needs the
+ * timebase across the wait. */
+void timebase_standby(void)
+{
+	set_sleep_mode(SLEEP_MODE_EXT_STANDBY);
+	sleep_enable();
+	sei(); // takes effect after the next instruction
+	sleep_cpu();
+	sleep_disable();
+	cli();
+}
+
+/* Have timebase_sleep() also return at a timestamp (the wake-up
+ * interrupt). Call with interrupts disabled. */
+void timebase_setWakeup(unsigned int when)
+{
+	OCR1A = when;
+	TIFR1 = _BV(OCF1A);
+	TIMSK1 |= _BV(OCIE1A);
+}
+
+void timebase_clearWakeup(void)
+{
+	TIMSK1 &= ~_BV(OCIE1A);
+}
+
+/* Sleep until a timestamp. Other interrupts (TWI) may run meanwhile. */
+void timebase_sleepUntil(unsigned int when)
+{
+	unsigned char sreg;
+
+	sreg = SREG;
+	cli();
+	timebase_setWakeup(when);
+	while ((int)(when - TCNT1) > 0) {
+		timebase_sleep();
+	}
+	timebase_clearWakeup();
+	SREG = sreg;
+}
+
+/* Return the number of ticks spent asleep since the previous call */
+unsigned long timebase_getAsleepTicks(void)
+{
+	unsigned char sreg;
+	unsigned long t;
+
+	sreg = SREG;
+	cli();
+	t = asleep_ticks;
+	asleep_ticks = 0;
+	SREG = sreg;
+
+	return t;
+}
+
@@ -0,0 +1,26 @@
+#ifndef _timebase_h__
+#define _timebase_h__
+
+/* Timer1 runs freely at F_CPU/8 and is the common time reference.
+ *
+ * It wraps around every 65536 ticks (43.7ms at 12MHz, 65.5ms at 8MHz),
+ * so only the difference between two recent timestamps is meaningful.
+ * Always subtract, never compare timestamps directly.
+ */
+#define TIMEBASE_PRESCALER			8
+
+#define TIMEBASE_US_TO_TICKS(us)	((unsigned int)(((unsigned long)(us) * (F_CPU / 1000L)) / (TIMEBASE_PRESCALER * 1000L)))
+#define TIMEBASE_TICKS_TO_US(t)		((unsigned int)(((unsigned long)(t) * (TIMEBASE_PRESCALER * 1000L)) / (F_CPU / 1000L)))
+
+void timebase_init(void);
+unsigned int timebase_now(void);
+
+void timebase_sleep(void);
+void timebase_standby(void);
+void timebase_sleepUntil(unsigned int when);
+void timebase_setWakeup(unsigned int when);
+void timebase_clearWakeup(void);
+unsigned long timebase_getAsleepTicks(void);
+
+#endif // _timebase_h__
+
@@ -10,6 +10,8 @@
 #include <string.h>
 #include "wiimote.h"
 #include "wm_crypto.h"
+#include "phase.h"
+#include "timebase.h"
 
 // The following adapted from libOGC wiiuse_internal.h
 #define WM_EXP_ID                   0xFA
@@ -22,6 +24,7 @@
 
 // pointer to user function
 static void (*wm_sample_event)();
+static void (*wm_fresh_report)(void);
 
 static volatile unsigned char g_enc_on = 0;
 
@@ -35,9 +38,19 @@ static volatile unsigned char wm_sb[8];
 static volatile unsigned char twi_reg[256];
 static volatile unsigned int twi_reg_addr;
 
+// Report banks. Reads of the first WM_REPORT_SIZE registers are served
+// from the front bank as it was when the wiimote addressed us, so a read
+// in progress never mixes two reports.
+static volatile unsigned char wm_report[2][WM_REPORT_SIZE];
+static volatile unsigned char wm_report_front;
+#define WM_NO_BANK	0xff
+static volatile unsigned char wm_tx_bank = WM_NO_BANK;
+
 static volatile unsigned char twi_first_addr_flag; // set address flag
 static volatile unsigned char twi_rw_len; // length of most recent operation
 
+static volatile unsigned int rumble_time;
+
 static volatile unsigned char alt_id_set;
 static volatile unsigned char alt_id_enabled;
 static volatile unsigned char alt_id[6];
@@ -48,6 +61,29 @@ unsigned char wm_getReg(unsigned char reg)
 	return twi_reg[reg];
 }
 
+unsigned char wm_getRumble(unsigned int *when)
+{
+	unsigned char sreg, value;
+
+	sreg = SREG;
+	cli();
+	value = twi_reg[WM_REG_RUMBLE];
+	*when = rumble_time;
+	SREG = sreg;
+
+	return value;
+}
+
+void wm_setRegs(unsigned char reg, const unsigned char *d, unsigned char len)
+{
+	unsigned char sreg;
+
+	sreg = SREG;
+	cli();
+	memcpy((void*)(twi_reg + reg), d, len);
+	SREG = sreg;
+}
+
 static void twi_slave_init(unsigned char addr)
 {
 	// initialize stuff
@@ -151,9 +187,19 @@ void wm_slaveTxStart(unsigned char addr)
 	{
 		// call user event
 		wm_sample_event();
+
+		// SCL is held low until the first byte is loaded
+		if (wm_fresh_report) {
+			wm_fresh_report();
+		}
 	}
 }
 
+void wm_setFreshReportFunc(void (*function)(void))
+{
+	wm_fresh_report = function;
+}
+
 void wm_slaveRx(unsigned char addr, unsigned char l)
 {
 	unsigned int i;
@@ -192,10 +238,38 @@ void wm_slaveRx(unsigned char addr, unsigned char l)
 	}
 }
 
+unsigned char *wm_getReportBuffer(void)
+{
+	unsigned char back = wm_report_front ^ 1;
+	unsigned int t;
+
+	// Two reports published during a single (long) read: Let the read
+	// complete before overwriting the bank it uses. The timeout is in case
+	// the wiimote gives up in the middle of the transfer.
+	t = timebase_now();
+	while (wm_tx_bank == back) {
+		if ((unsigned int)(timebase_now() - t) > TIMEBASE_US_TO_TICKS(1000))
+			break;
+	}
+
+	return (unsigned char*)wm_report[back];
+}
+
+void wm_publishReport(void)
+{
+	// Only the main loop writes this, and the ISR reads it once
+	// per transfer. A single byte store is atomic.
+	wm_report_front ^= 1;
+}
+
 void wm_newaction(unsigned char * d, unsigned char len)
 {
+	unsigned char *dst = wm_getReportBuffer();
+
 	// load button data from user application
-	memcpy((void*)twi_reg, d, len);
+	memcpy(dst, d, len);
+	memset(dst + len, 0, WM_REPORT_SIZE - len);
+	wm_publishReport();
 }
 
 void wm_init(unsigned char * id, unsigned char * t, unsigned char len, unsigned char * cal_data, void (*function)(void))
@@ -206,7 +280,8 @@ void wm_init(unsigned char * id, unsigned char * t, unsigned char len, unsigned
 	wm_sample_event = function;
 
 	// start state
-	wm_newaction(t, len);
+	memcpy((void*)wm_report[0], t, len);
+	memcpy((void*)wm_report[1], t, len);
 	twi_reg[WM_EXP_MEM_ENABLE1] = 0; // disable encryption
 
 	// set id
@@ -276,6 +351,8 @@ ISR(TWI_vect)
 		case TW_SR_GCALL_ACK: // addressed generally, returned ack
 		case TW_SR_ARB_LOST_SLA_ACK: // lost arbitration, returned ack
 		case TW_SR_ARB_LOST_GCALL_ACK: // lost arbitration generally, returned ack
+			phase_i2cStart();
+			wm_tx_bank = WM_NO_BANK;
 			// get ready to receive pointer
 			twi_first_addr_flag = 0;
 			// ack
@@ -305,12 +382,15 @@ ISR(TWI_vect)
 			if(g_enc_on ) // if encryption is on
 			{
 				// decrypt
-				twi_reg[twi_reg_addr] = (t ^ wm_sb[twi_reg_addr % 8]) + wm_ft[twi_reg_addr % 8];
+				t = (t ^ wm_sb[twi_reg_addr % 8]) + wm_ft[twi_reg_addr % 8];
 			}
-			else
-			{
-				twi_reg[twi_reg_addr] = t;
+
+			// Timestamp for the rumble latency
+			if ((twi_reg_addr == WM_REG_RUMBLE) && (!t != !twi_reg[WM_REG_RUMBLE])) {
+				rumble_time = TCNT1;
 			}
+
+			twi_reg[twi_reg_addr] = t;
 			twi_reg_addr++;
 			twi_rw_len++;
 		}
@@ -324,6 +404,7 @@ ISR(TWI_vect)
 		twi_clear_int(1); // ack
 			break;
 		case TW_SR_STOP: // stop or repeated start condition received
+			phase_i2cEnd();
 			// run user defined function
 			wm_slaveRx(twi_reg_addr - twi_rw_len, twi_rw_len);
 			twi_clear_int(1); // ack future responses
@@ -336,30 +417,45 @@ ISR(TWI_vect)
 		// Slave Tx
 		case TW_ST_SLA_ACK:	// addressed, returned ack
 		case TW_ST_ARB_LOST_SLA_ACK: // arbitration lost, returned ack
+			phase_i2cStart();
 			// run user defined function
 			wm_slaveTxStart(twi_reg_addr);
+			wm_tx_bank = wm_report_front;
 			twi_rw_len = 0;
 		case TW_ST_DATA_ACK: // byte sent, ack returned
+		{
+			unsigned char t;
+
 			// ready output byte
+			if (twi_reg_addr < WM_REPORT_SIZE && wm_tx_bank != WM_NO_BANK) {
+				t = wm_report[wm_tx_bank][twi_reg_addr];
+			} else {
+				t = twi_reg[twi_reg_addr];
+			}
+
 			if(g_enc_on) // encryption is on
 			{
 				// encrypt
-				TWDR = (twi_reg[twi_reg_addr] - wm_ft[twi_reg_addr % 8]) ^ wm_sb[twi_reg_addr % 8];
+				TWDR = (t - wm_ft[twi_reg_addr % 8]) ^ wm_sb[twi_reg_addr % 8];
 			}
 			else
 			{
-				TWDR = twi_reg[twi_reg_addr];
+				TWDR = t;
 			}
 			twi_reg_addr++;
 			twi_rw_len++;
 			twi_clear_int(1); // ack
 			break;
+		}
 		case TW_ST_DATA_NACK: // received nack, we are done 
 		case TW_ST_LAST_DATA: // received ack, but we are done already!
+			phase_i2cEnd();
+			wm_tx_bank = WM_NO_BANK;
 			// ack future responses
 			twi_clear_int(1);
 			break;
 		default:
+			wm_tx_bank = WM_NO_BANK;
 			twi_clear_int(0);
 			break;
 	}
@@ -25,10 +25,30 @@ char wm_isStarted(void);
 char wm_altIdEnabled(void);
 void wm_setAltId(unsigned char id[6]);
 
+// Size of the report area (registers 0x00 and up) that is double-buffered
+#define WM_REPORT_SIZE	17
+
 // set button data
 void wm_newaction(unsigned char *, unsigned char len);
 
+// Build the next report in place: Fill the buffer returned by
+// wm_getReportBuffer() and make it visible with wm_publishReport().
+unsigned char *wm_getReportBuffer(void);
+void wm_publishReport(void);
+
+// Called by the TWI interrupt when the wiimote starts reading the report
+// (registers 0x00-0x05), before the first byte is sent. The wiimote is
+// held waiting (clock stretching) meanwhile, so this must be short. A
+// report published from there is the one sent.
+void wm_setFreshReportFunc(void (*function)(void));
+
+// Rumble register, written by the wiimote (see classic.c). Non-zero for
+// on. *when receives the time (timebase) of the last change.
+#define WM_REG_RUMBLE	0x06
+unsigned char wm_getRumble(unsigned int *when);
+
 unsigned char wm_getReg(unsigned char reg);
+void wm_setRegs(unsigned char reg, const unsigned char *d, unsigned char len);
 
 #define wiimote_h
 #endif